@@ -0,0 +1,188 @@
+#!/usr/bin/env python3
+"""Generate a synthetic LLVM IR module for benchmarking the memcheck pass.
+
+Functions cycle through a few kernels (streaming loops, loop nests, struct walks, gathers and
+memory intrinsics), each calling a few earlier functions, so that every analysis of the pass has
+work to do. All functions carry debug info under <root>/src, which the benchmark passes as
+$SCOP_ROOT. The output uses typed pointers, which every supported LLVM version still parses.
+"""
+import argparse
+import random
+
+HEADER = """\
+%struct.Rec = type {{ i32, i64, [6 x double], i8, double }}
+
+declare void @llvm.memcpy.p0i8.p0i8.i64(i8*, i8*, i64, i1)
+declare i8* @malloc(i64)
+"""
+
+KERNELS = {
+    "stream": """\
+define void @{name}(double* %a, double* %b, double* %c, i64 %n) !dbg !{sp} {{
+entry:
+{calls}  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pb = getelementptr double, double* %b, i64 %i
+  %vb = load double, double* %pb, !dbg !{loc}
+  %pc = getelementptr double, double* %c, i64 %i
+  %vc = load double, double* %pc, !dbg !{loc}
+  %m = fmul double %vc, 3.0
+  %s = fadd double %vb, %m
+  %pa = getelementptr double, double* %a, i64 %i
+  store double %s, double* %pa, !dbg !{loc}
+  %i.next = add i64 %i, 1
+  %cmp = icmp slt i64 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}}
+""",
+    "nest": """\
+define void @{name}(double* %a, double* %b, double* %c, i64 %n) !dbg !{sp} {{
+entry:
+{calls}  br label %outer
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %row = mul i64 %i, 64
+  br label %inner
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %k = add i64 %row, %j
+  %pb = getelementptr double, double* %b, i64 %k
+  %vb = load double, double* %pb, !dbg !{loc}
+  %jt = mul i64 %j, 64
+  %pc = getelementptr double, double* %c, i64 %jt
+  %vc = load double, double* %pc, !dbg !{loc}
+  %pa = getelementptr double, double* %a, i64 %i
+  %va = load double, double* %pa, !dbg !{loc}
+  %m = fmul double %vb, %vc
+  %s = fadd double %va, %m
+  store double %s, double* %pa, !dbg !{loc}
+  %j.next = add i64 %j, 1
+  %cj = icmp slt i64 %j.next, 64
+  br i1 %cj, label %inner, label %outer.latch
+outer.latch:
+  %i.next = add i64 %i, 1
+  %ci = icmp slt i64 %i.next, 64
+  br i1 %ci, label %outer, label %exit
+exit:
+  ret void
+}}
+""",
+    "records": """\
+define void @{name}(double* %a, double* %b, double* %c, i64 %n) !dbg !{sp} {{
+entry:
+{calls}  %recs = bitcast double* %a to %struct.Rec*
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pkey = getelementptr %struct.Rec, %struct.Rec* %recs, i64 %i, i32 1
+  %key = load i64, i64* %pkey, !dbg !{loc}
+  %pval = getelementptr %struct.Rec, %struct.Rec* %recs, i64 %i, i32 2, i64 3
+  %val = load double, double* %pval, !dbg !{loc}
+  %pw = getelementptr %struct.Rec, %struct.Rec* %recs, i64 %i, i32 4
+  %w = fadd double %val, 1.0
+  store double %w, double* %pw, !dbg !{loc}
+  %again = load i64, i64* %pkey, !dbg !{loc}
+  %i.next = add i64 %i, 1
+  %cmp = icmp slt i64 %i.next, 256
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}}
+""",
+    "gather": """\
+define void @{name}(double* %a, double* %b, double* %c, i64 %n) !dbg !{sp} {{
+entry:
+{calls}  %idx = bitcast double* %c to i32*
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pi = getelementptr i32, i32* %idx, i64 %i
+  %j = load i32, i32* %pi, !dbg !{loc}
+  %j64 = sext i32 %j to i64
+  %pb = getelementptr double, double* %b, i64 %j64
+  %vb = load double, double* %pb, !dbg !{loc}
+  %is = mul i64 %i, %n
+  %pa = getelementptr double, double* %a, i64 %is
+  store double %vb, double* %pa, !dbg !{loc}
+  %i.next = add i64 %i, 1
+  %cmp = icmp slt i64 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}}
+""",
+    "copy": """\
+define void @{name}(double* %a, double* %b, double* %c, i64 %n) !dbg !{sp} {{
+entry:
+{calls}  %tmp = alloca [32 x double]
+  %t8 = bitcast [32 x double]* %tmp to i8*
+  %b8 = bitcast double* %b to i8*
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %t8, i8* %b8, i64 256, i1 false), !dbg !{loc}
+  %heap = call i8* @malloc(i64 %n), !dbg !{loc}
+  %a8 = bitcast double* %a to i8*
+  call void @llvm.memcpy.p0i8.p0i8.i64(i8* %heap, i8* %a8, i64 %n, i1 false), !dbg !{loc}
+  %p0 = getelementptr [32 x double], [32 x double]* %tmp, i64 0, i64 0
+  %v0 = load double, double* %p0, !dbg !{loc}
+  store double %v0, double* %c, !dbg !{loc}
+  store double %v0, double* %c, !dbg !{loc}
+  ret void
+}}
+""",
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("-o", "--output", required=True, help="output .ll file")
+    parser.add_argument("--functions", type=int, default=20000, help="number of functions (default 20000)")
+    parser.add_argument("--calls", type=int, default=3, help="calls to earlier functions per function (default 3)")
+    parser.add_argument("--seed", type=int, default=1, help="random seed (default 1)")
+    parser.add_argument("--root", default="/memcheck-bench", help="source root of the debug info")
+    args = parser.parse_args()
+
+    rng = random.Random(args.seed)
+    kernels = list(KERNELS)
+    names = []
+    body = []
+    metadata = []
+    # !0 compile unit, !1 file, !2 and !3 module flags, !4 subroutine type, then per function
+    # a subprogram and a location
+    next_id = 5
+    for index in range(args.functions):
+        kernel = kernels[index % len(kernels)]
+        name = "f{}_{}".format(index, kernel)
+        sp, loc = next_id, next_id + 1
+        next_id += 2
+        calls = ""
+        for call in range(min(args.calls, len(names))):
+            callee = names[rng.randrange(len(names))]
+            calls += "  call void @{}(double* %a, double* %b, double* %c, i64 %n), !dbg !{}\n".format(callee, loc)
+        body.append(KERNELS[kernel].format(name=name, sp=sp, loc=loc, calls=calls))
+        metadata.append('!{} = distinct !DISubprogram(name: "{}", scope: !1, file: !1, line: {}, type: !4, '
+                        'unit: !0)\n'.format(sp, name, 10 * index + 1))
+        metadata.append("!{} = !DILocation(line: {}, column: 3, scope: !{})\n".format(loc, 10 * index + 2, sp))
+        names.append(name)
+
+    with open(args.output, "w") as out:
+        out.write("; Generated by generate_module.py --functions {} --calls {} --seed {}\n".format(
+            args.functions, args.calls, args.seed))
+        out.write('source_filename = "bench.c"\n')
+        out.write('target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"\n\n')
+        out.write(HEADER.format())
+        for function in body:
+            out.write("\n" + function)
+        out.write("\n!llvm.dbg.cu = !{!0}\n!llvm.module.flags = !{!2, !3}\n\n")
+        out.write('!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "generate_module.py", '
+                  'isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug)\n')
+        out.write('!1 = !DIFile(filename: "bench.c", directory: "{}/src")\n'.format(args.root))
+        out.write('!2 = !{i32 2, !"Debug Info Version", i32 3}\n')
+        out.write('!3 = !{i32 7, !"Dwarf Version", i32 5}\n')
+        out.write("!4 = !DISubroutineType(types: !{})\n")
+        out.writelines(metadata)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,97 @@
+#!/usr/bin/env python3
+"""Measure the cost of the memcheck pass on a corpus of modules.
+
+Every module is analyzed --repeat times by opt with the plugin, in a scratch directory so the
+reports of the pass do not pile up. For each module the best wall time, the peak RSS of opt and
+the reported functions per second are printed. With --json the results are saved, and with
+--baseline they are compared against an earlier run: the script fails if any module got slower
+or bigger by more than --max-regression.
+"""
+import argparse
+import json
+import os
+import shlex
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def run_once(args, module, scratch):
+    command = [args.opt, "-load", args.plugin, "-load-pass-plugin", args.plugin, "-disable-output",
+               "-passes=" + args.passes, "-memcheck-quiet"] + shlex.split(args.pass_args) + [module]
+    env = dict(os.environ, SCOP_ROOT=args.root)
+    start = time.perf_counter()
+    process = subprocess.Popen(command, cwd=scratch, env=env, stdout=subprocess.DEVNULL,
+                               stderr=subprocess.PIPE)
+    stderr = process.stderr.read()
+    _, status, usage = os.wait4(process.pid, 0)
+    wall = time.perf_counter() - start
+    if not os.WIFEXITED(status) or os.WEXITSTATUS(status):
+        sys.stderr.write(stderr.decode(errors="replace"))
+        raise SystemExit("Error: opt failed on {}".format(module))
+
+    report = os.path.join(scratch, "static_function_analysis.csv")
+    with open(report) as csv:
+        functions = max(0, sum(1 for line in csv if line.strip()) - 1)
+    # ru_maxrss is in KiB on Linux
+    return wall, usage.ru_maxrss * 1024, functions
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("modules", nargs="+", help="bitcode or IR modules to analyze")
+    parser.add_argument("--opt", default="opt", help="opt binary (default opt)")
+    parser.add_argument("--plugin", required=True, help="the StaticMemCheck plugin")
+    parser.add_argument("--root", default="/memcheck-bench", help="$SCOP_ROOT of the modules")
+    parser.add_argument("--passes", default="memcheck", help="pass pipeline (default memcheck)")
+    parser.add_argument("--pass-args", default="", help="extra options of the pass, e.g. '-memcheck-loops'")
+    parser.add_argument("--repeat", type=int, default=3, help="runs per module, the best is kept (default 3)")
+    parser.add_argument("--json", help="save the results to this file")
+    parser.add_argument("--baseline", help="results of an earlier run to compare against")
+    parser.add_argument("--max-regression", type=float, default=0.25,
+                        help="tolerated slowdown or growth against the baseline (default 0.25)")
+    args = parser.parse_args()
+
+    results = {}
+    print("{:<24} {:>10} {:>10} {:>14} {:>14}".format("Module", "Functions", "Wall (s)", "Peak RSS (MiB)",
+                                                       "Functions/s"))
+    for module in args.modules:
+        name = os.path.basename(module)
+        best_wall, peak_rss, functions = None, 0, 0
+        for _ in range(max(1, args.repeat)):
+            with tempfile.TemporaryDirectory(prefix="memcheck-bench-") as scratch:
+                wall, rss, functions = run_once(args, os.path.abspath(module), scratch)
+            best_wall = wall if best_wall is None else min(best_wall, wall)
+            peak_rss = max(peak_rss, rss)
+        rate = functions / best_wall if best_wall > 0 else 0.0
+        results[name] = {"functions": functions, "wall": best_wall, "peak_rss": peak_rss,
+                         "functions_per_second": rate}
+        print("{:<24} {:>10} {:>10.3f} {:>14.1f} {:>14.0f}".format(name, functions, best_wall,
+                                                                   peak_rss / (1 << 20), rate))
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump({"pass_args": args.pass_args, "results": results}, out, indent=2)
+
+    if args.baseline:
+        with open(args.baseline) as baseline_file:
+            baseline = json.load(baseline_file)["results"]
+        regressions = []
+        for name, result in results.items():
+            if name not in baseline:
+                continue
+            for metric in ("wall", "peak_rss"):
+                before, after = baseline[name][metric], result[metric]
+                if before > 0 and after > before * (1 + args.max_regression):
+                    regressions.append("{}: {} {:.3g} -> {:.3g} (+{:.0f}%)".format(
+                        name, metric, before, after, 100 * (after / before - 1)))
+        for regression in regressions:
+            print("Regression: " + regression, file=sys.stderr)
+        if regressions:
+            return 1
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
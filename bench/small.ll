@@ -0,0 +1,222 @@
+; Small benchmark module: one kernel per analysis of the pass, with debug info under
+; /memcheck-bench/src (the $SCOP_ROOT of the benchmark).
+source_filename = "small.c"
+target datalayout = "e-m:e-p270:32:32-p271:32:32-p272:64:64-i64:64-f80:128-n8:16:32:64-S128"
+
+%struct.ident_t = type { i32, i32, i32, i32, i8* }
+%struct.Node = type { i32, i64, [4 x i8], double, i8 }
+
+@0 = private constant %struct.ident_t zeroinitializer
+
+declare i8* @malloc(i64)
+declare i8* @_Znwm(i64)
+declare void @free(i8*)
+declare void @__kmpc_fork_call(%struct.ident_t*, i32, void (i32*, i32*, ...)*, ...)
+declare void @__kmpc_for_static_init_4(%struct.ident_t*, i32, i32, i32*, i32*, i32*, i32*, i32, i32)
+declare void @__kmpc_for_static_fini(%struct.ident_t*, i32)
+declare i32 @llvm.nvvm.read.ptx.sreg.tid.x()
+
+; Unit-stride, strided, indirect and invariant accesses
+define void @streams(double* %a, double* %b, i32* %idx, double* %c, i64 %n, i64 %s) !dbg !10 {
+entry:
+  %x = load double, double* %c, !dbg !30
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %pa = getelementptr double, double* %a, i64 %i
+  %va = load double, double* %pa, !dbg !31
+  %i2 = mul i64 %i, 4
+  %pb = getelementptr double, double* %b, i64 %i2
+  store double %va, double* %pb, !dbg !31
+  %pi = getelementptr i32, i32* %idx, i64 %i
+  %j = load i32, i32* %pi, !dbg !32
+  %j64 = sext i32 %j to i64
+  %pg = getelementptr double, double* %a, i64 %j64
+  %vg = load double, double* %pg, !dbg !32
+  %is = mul i64 %i, %s
+  %ps = getelementptr double, double* %b, i64 %is
+  store double %vg, double* %ps, !dbg !33
+  %inv = load double, double* %c, !dbg !33
+  %i.next = add i64 %i, 1
+  %cmp = icmp slt i64 %i.next, %n
+  br i1 %cmp, label %loop, label %exit
+exit:
+  ret void
+}
+
+; A 64x64 loop nest whose working set exceeds L1
+define void @matvec(double* %y, double* %m, double* %x) !dbg !11 {
+entry:
+  br label %outer
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  %py = getelementptr double, double* %y, i64 %i
+  %row = mul i64 %i, 512
+  br label %inner
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %k = add i64 %row, %j
+  %pm = getelementptr double, double* %m, i64 %k
+  %vm = load double, double* %pm, !dbg !34
+  %px = getelementptr double, double* %x, i64 %j
+  %vx = load double, double* %px, !dbg !34
+  %vy = load double, double* %py, !dbg !35
+  %p = fmul double %vm, %vx
+  %s = fadd double %vy, %p
+  store double %s, double* %py, !dbg !35
+  %j.next = add i64 %j, 1
+  %cj = icmp slt i64 %j.next, 512
+  br i1 %cj, label %inner, label %outer.latch
+outer.latch:
+  %i.next = add i64 %i, 1
+  %ci = icmp slt i64 %i.next, 512
+  br i1 %ci, label %outer, label %exit
+exit:
+  ret void
+}
+
+; Struct field accesses, a redundant load and a dead store
+define void @walk(%struct.Node* %n) !dbg !12 {
+entry:
+  %f0 = getelementptr %struct.Node, %struct.Node* %n, i64 0, i32 0
+  store i32 0, i32* %f0, !dbg !36
+  store i32 1, i32* %f0, !dbg !36
+  br label %loop
+loop:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %loop ]
+  %p = getelementptr %struct.Node, %struct.Node* %n, i64 %i, i32 3
+  %v = load double, double* %p, !dbg !37
+  %again = load double, double* %p, !dbg !37
+  %q = getelementptr %struct.Node, %struct.Node* %n, i64 %i, i32 1
+  store i64 %i, i64* %q, !dbg !38
+  %i.next = add i64 %i, 1
+  %c = icmp slt i64 %i.next, 100
+  br i1 %c, label %loop, label %exit
+exit:
+  ret void
+}
+
+; Heap allocations in a loop nest
+define void @allocs(i64 %n) !dbg !13 {
+entry:
+  %x = call i8* @malloc(i64 8), !dbg !39
+  br label %outer
+outer:
+  %i = phi i64 [ 0, %entry ], [ %i.next, %outer.latch ]
+  br label %inner
+inner:
+  %j = phi i64 [ 0, %outer ], [ %j.next, %inner ]
+  %y = call i8* @_Znwm(i64 16), !dbg !40
+  call void @free(i8* %y), !dbg !40
+  %j.next = add i64 %j, 1
+  %cj = icmp slt i64 %j.next, 10
+  br i1 %cj, label %inner, label %outer.latch
+outer.latch:
+  %i.next = add i64 %i, 1
+  %ci = icmp slt i64 %i.next, %n
+  br i1 %ci, label %outer, label %exit
+exit:
+  call void @free(i8* %x), !dbg !39
+  ret void
+}
+
+; An OpenMP parallel loop with per-thread counters
+define void @parallel(double* %a, i64* %counts) !dbg !14 {
+entry:
+  call void (%struct.ident_t*, i32, void (i32*, i32*, ...)*, ...) @__kmpc_fork_call(%struct.ident_t* @0, i32 2, void (i32*, i32*, ...)* bitcast (void (i32*, i32*, double*, i64*)* @.omp_outlined. to void (i32*, i32*, ...)*), double* %a, i64* %counts), !dbg !41
+  ret void
+}
+
+define internal void @.omp_outlined.(i32* noalias %.global_tid., i32* noalias %.bound_tid., double* %a, i64* %counts) !dbg !15 {
+entry:
+  %lb = alloca i32
+  %ub = alloca i32
+  %st = alloca i32
+  %last = alloca i32
+  store i32 0, i32* %lb
+  store i32 9999, i32* %ub
+  store i32 1, i32* %st
+  %gtid = load i32, i32* %.global_tid.
+  call void @__kmpc_for_static_init_4(%struct.ident_t* @0, i32 %gtid, i32 34, i32* %last, i32* %lb, i32* %ub, i32* %st, i32 1, i32 1), !dbg !42
+  %l = load i32, i32* %lb
+  %u = load i32, i32* %ub
+  %guard = icmp sle i32 %l, %u
+  br i1 %guard, label %body, label %done
+body:
+  %i = phi i32 [ %l, %entry ], [ %i.next, %body ]
+  %i64 = sext i32 %i to i64
+  %pa = getelementptr double, double* %a, i64 %i64
+  store double 1.0, double* %pa, !dbg !42
+  %t = sext i32 %gtid to i64
+  %pc = getelementptr i64, i64* %counts, i64 %t
+  %count = load i64, i64* %pc, !dbg !43
+  %count.next = add i64 %count, 1
+  store i64 %count.next, i64* %pc, !dbg !43
+  %i.next = add i32 %i, 1
+  %c = icmp sle i32 %i.next, %u
+  br i1 %c, label %body, label %done
+done:
+  call void @__kmpc_for_static_fini(%struct.ident_t* @0, i32 %gtid), !dbg !42
+  ret void
+}
+
+; A GPU kernel whose index hashes the thread index: not coalesced (-memcheck-gpu)
+define ptx_kernel void @hashed(float addrspace(1)* %a, float addrspace(1)* %b) !dbg !17 {
+entry:
+  %tid = call i32 @llvm.nvvm.read.ptx.sreg.tid.x(), !range !46
+  %mul = mul i32 %tid, 37
+  %hash = xor i32 %mul, 1023
+  %idx = zext i32 %hash to i64
+  %pa = getelementptr inbounds float, float addrspace(1)* %a, i64 %idx
+  %v = load float, float addrspace(1)* %pa, align 4, !dbg !47
+  %ptid = zext i32 %tid to i64
+  %pb = getelementptr inbounds float, float addrspace(1)* %b, i64 %ptid
+  store float %v, float addrspace(1)* %pb, align 4, !dbg !47
+  ret void
+}
+
+; The call graph root
+define void @driver(double* %a, double* %b, i32* %idx, i64* %counts, %struct.Node* %node, i64 %n) !dbg !16 {
+entry:
+  call void @streams(double* %a, double* %b, i32* %idx, double* %a, i64 %n, i64 3), !dbg !44
+  call void @matvec(double* %a, double* %b, double* %a), !dbg !44
+  call void @walk(%struct.Node* %node), !dbg !45
+  call void @allocs(i64 %n), !dbg !45
+  call void @parallel(double* %a, i64* %counts), !dbg !45
+  ret void
+}
+
+!llvm.dbg.cu = !{!0}
+!llvm.module.flags = !{!2, !3}
+
+!0 = distinct !DICompileUnit(language: DW_LANG_C99, file: !1, producer: "clang", isOptimized: true, runtimeVersion: 0, emissionKind: FullDebug)
+!1 = !DIFile(filename: "small.c", directory: "/memcheck-bench/src")
+!2 = !{i32 2, !"Debug Info Version", i32 3}
+!3 = !{i32 7, !"Dwarf Version", i32 5}
+!4 = !DISubroutineType(types: !{})
+!10 = distinct !DISubprogram(name: "streams", scope: !1, file: !1, line: 1, type: !4, unit: !0)
+!11 = distinct !DISubprogram(name: "matvec", scope: !1, file: !1, line: 10, type: !4, unit: !0)
+!12 = distinct !DISubprogram(name: "walk", scope: !1, file: !1, line: 20, type: !4, unit: !0)
+!13 = distinct !DISubprogram(name: "allocs", scope: !1, file: !1, line: 30, type: !4, unit: !0)
+!14 = distinct !DISubprogram(name: "parallel", scope: !1, file: !1, line: 40, type: !4, unit: !0)
+!15 = distinct !DISubprogram(name: ".omp_outlined.", scope: !1, file: !1, line: 41, type: !4, unit: !0)
+!16 = distinct !DISubprogram(name: "driver", scope: !1, file: !1, line: 50, type: !4, unit: !0)
+!17 = distinct !DISubprogram(name: "hashed", scope: !1, file: !1, line: 60, type: !4, unit: !0)
+!30 = !DILocation(line: 2, column: 3, scope: !10)
+!31 = !DILocation(line: 4, column: 5, scope: !10)
+!32 = !DILocation(line: 5, column: 5, scope: !10)
+!33 = !DILocation(line: 6, column: 5, scope: !10)
+!34 = !DILocation(line: 13, column: 7, scope: !11)
+!35 = !DILocation(line: 14, column: 7, scope: !11)
+!36 = !DILocation(line: 21, column: 3, scope: !12)
+!37 = !DILocation(line: 23, column: 5, scope: !12)
+!38 = !DILocation(line: 24, column: 5, scope: !12)
+!39 = !DILocation(line: 31, column: 3, scope: !13)
+!40 = !DILocation(line: 33, column: 7, scope: !13)
+!41 = !DILocation(line: 40, column: 3, scope: !14)
+!42 = !DILocation(line: 42, column: 5, scope: !15)
+!43 = !DILocation(line: 43, column: 5, scope: !15)
+!44 = !DILocation(line: 51, column: 3, scope: !16)
+!45 = !DILocation(line: 52, column: 3, scope: !16)
+!46 = !{i32 0, i32 1024}
+!47 = !DILocation(line: 61, column: 3, scope: !17)
@@ -0,0 +1,258 @@
+/**
+ * @file memCheckCalibrate.cpp
+ * @brief Compares the static estimates of the memcheck pass with the counts of an instrumented run.
+ *
+ * The static report and the dynamic report written by the memcheck-instrument runtime are joined
+ * by mangled name. For every function the static model predicts the measured total of a metric:
+ *
+ *   profile  'Profile <metric>', already a total over the profiled runs
+ *   loops    'Dynamic <metric>' (loop weighted, per invocation) times the measured calls
+ *   static   '<metric>' (straight-line count, per invocation) times the measured calls
+ *
+ * Functions are ranked by how wrong the prediction is, and a summary tells how many of them are
+ * within -tolerance of the measurement.
+ */
+#include "memCheckReport.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cmath>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> StaticReport(cl::Positional, cl::Required, cl::desc("<static report.csv>"));
+static cl::opt<std::string> DynamicReport(cl::Positional, cl::Required, cl::desc("<dynamic report.csv>"));
+
+static cl::opt<std::string> OutputFileName(
+    "o", cl::desc("Output file (default = stdout)"), cl::value_desc("filename"), cl::init("-"));
+
+enum class Metric { Loads, Stores, Bytes };
+static cl::opt<Metric> MetricOption(
+    "metric", cl::desc("Metric to compare (default = bytes)"), cl::init(Metric::Bytes),
+    cl::values(clEnumValN(Metric::Loads, "loads", "Loads"),
+               clEnumValN(Metric::Stores, "stores", "Stores"),
+               clEnumValN(Metric::Bytes, "bytes", "Bytes")));
+
+enum class Model { Auto, Static, Loops, Profile };
+static cl::opt<Model> ModelOption(
+    "model", cl::desc("Static model to calibrate (default = auto, the most precise one in the report)"),
+    cl::init(Model::Auto),
+    cl::values(clEnumValN(Model::Auto, "auto", "Profile if available, then loops, then static"),
+               clEnumValN(Model::Static, "static", "Straight-line counts times the measured calls"),
+               clEnumValN(Model::Loops, "loops", "Loop weighted counts (-memcheck-loops) times the measured calls"),
+               clEnumValN(Model::Profile, "profile", "Profile weighted counts (-memcheck-profile)")));
+
+enum class Rank { Absolute, Ratio };
+static cl::opt<Rank> RankOption(
+    "rank", cl::desc("Ranking of the functions (default = absolute)"), cl::init(Rank::Absolute),
+    cl::values(clEnumValN(Rank::Absolute, "absolute", "Largest absolute error first"),
+               clEnumValN(Rank::Ratio, "ratio", "Largest error ratio first, in either direction")));
+
+static cl::opt<double> Tolerance(
+    "tolerance", cl::desc("Error ratio under which an estimate is trusted (default = 2.0)"), cl::init(2.0));
+
+static cl::opt<unsigned> TopCount("n", cl::desc("Number of functions to list (default = all)"), cl::init(0));
+
+namespace {
+  /**
+   * @brief A report loaded in memory, with its header.
+   */
+  struct Report {
+    std::unique_ptr<MemoryBuffer> buffer;
+    StringRef header;
+    std::vector<StringRef> rows;
+
+    /**
+     * @brief Load a CSV report.
+     * @return false if the report cannot be read or is empty.
+     */
+    bool load(StringRef fileName) {
+      auto file = MemoryBuffer::getFile(fileName);
+      if (!file) {
+        errs() << "Error: cannot read " << fileName << ": " << file.getError().message() << "\n";
+        return false;
+      }
+      buffer = std::move(*file);
+      line_iterator line(*buffer, /*SkipBlanks=*/true);
+      if (line.is_at_eof()) {
+        errs() << "Error: " << fileName << " is empty\n";
+        return false;
+      }
+      header = *line;
+      for (++line; !line.is_at_eof(); ++line)
+        rows.push_back(*line);
+      return true;
+    }
+
+    /**
+     * @brief Find a column, printing an error if it is missing.
+     */
+    int requireColumn(StringRef name) const {
+      int column = memcheckReport::findCSVColumn(header, name);
+      if (column < 0)
+        errs() << "Error: " << buffer->getBufferIdentifier() << " has no column '" << name << "'\n";
+      return column;
+    }
+  };
+
+  /**
+   * @brief A function of both reports.
+   */
+  struct Comparison {
+    StringRef demangledName;  /* Raw CSV fields, still quoted */
+    StringRef mangledName;
+    uint64_t calls;
+    uint64_t predicted;
+    uint64_t measured;
+
+    uint64_t getAbsoluteError() const {
+      return predicted > measured ? predicted - measured : measured - predicted;
+    }
+
+    /* Error ratio in either direction, at least 1; infinite if only one side is zero */
+    double getErrorRatio() const {
+      if (predicted == measured)
+        return 1.0;
+      if (!predicted || !measured)
+        return INFINITY;
+      return predicted > measured ? double(predicted) / measured : double(measured) / predicted;
+    }
+  };
+
+  uint64_t getCounter(StringRef row, int column) {
+    uint64_t value = 0;
+    if (memcheckReport::getCSVField(row, column).trim().getAsInteger(10, value))
+      return 0;
+    return value;
+  }
+
+  StringRef getMetricName() {
+    switch (MetricOption) {
+      case Metric::Loads: return "Loads";
+      case Metric::Stores: return "Stores";
+      case Metric::Bytes: return "Bytes";
+    }
+    return "Bytes";
+  }
+} /* end of anonymous namespace */
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "memcheck static-vs-dynamic calibration\n");
+
+  Report staticReport, dynamicReport;
+  if (!staticReport.load(StaticReport) || !dynamicReport.load(DynamicReport))
+    return 1;
+
+  /* Pick the static column of the model */
+  std::string metric = getMetricName().str();
+  Model model = ModelOption;
+  if (model == Model::Auto) {
+    if (memcheckReport::findCSVColumn(staticReport.header, "Profile " + metric) >= 0)
+      model = Model::Profile;
+    else if (memcheckReport::findCSVColumn(staticReport.header, "Dynamic " + metric) >= 0)
+      model = Model::Loops;
+    else
+      model = Model::Static;
+  }
+  std::string staticColumnName = model == Model::Profile ? "Profile " + metric
+                                 : model == Model::Loops ? "Dynamic " + metric
+                                                         : metric;
+  int staticColumn = staticReport.requireColumn(staticColumnName);
+  int dynamicColumn = dynamicReport.requireColumn(metric);
+  int callsColumn = dynamicReport.requireColumn("Calls");
+  if (staticColumn < 0 || dynamicColumn < 0 || callsColumn < 0)
+    return 1;
+
+  /* Join by mangled name; the first row of a name wins, like memcheck-merge */
+  StringMap<StringRef> measuredRows;
+  for (StringRef row : dynamicReport.rows)
+    measuredRows.try_emplace(memcheckReport::getCSVField(row, memcheckReport::mangledNameColumn), row);
+
+  std::vector<Comparison> comparisons;
+  size_t staticOnly = 0;
+  StringMap<bool> joined;
+  for (StringRef row : staticReport.rows) {
+    StringRef key = memcheckReport::getCSVField(row, memcheckReport::mangledNameColumn);
+    auto measuredRow = measuredRows.find(key);
+    if (measuredRow == measuredRows.end()) {
+      ++staticOnly;
+      continue;
+    }
+    if (!joined.try_emplace(key, true).second)
+      continue;
+
+    Comparison comparison;
+    comparison.demangledName = memcheckReport::getCSVField(row, 0);
+    comparison.mangledName = key;
+    comparison.calls = getCounter(measuredRow->second, callsColumn);
+    comparison.measured = getCounter(measuredRow->second, dynamicColumn);
+    comparison.predicted = getCounter(row, staticColumn);
+    if (model != Model::Profile)
+      comparison.predicted = SaturatingMultiply(comparison.predicted, comparison.calls);
+    /* Functions that never ran and were predicted not to tell nothing */
+    if (comparison.predicted || comparison.measured)
+      comparisons.push_back(comparison);
+  }
+
+  if (RankOption == Rank::Absolute) {
+    std::stable_sort(comparisons.begin(), comparisons.end(), [](const Comparison &a, const Comparison &b) {
+      return a.getAbsoluteError() > b.getAbsoluteError();
+    });
+  } else {
+    std::stable_sort(comparisons.begin(), comparisons.end(), [](const Comparison &a, const Comparison &b) {
+      return a.getErrorRatio() > b.getErrorRatio();
+    });
+  }
+
+  std::error_code EC;
+  raw_fd_ostream out(OutputFileName, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Error: cannot open " << OutputFileName << ": " << EC.message() << "\n";
+    return 1;
+  }
+  out << "'Function Name (Demangled)','Function Name (Mangled)','Calls','Predicted " << metric
+      << "','Measured " << metric << "','Ratio','Absolute Error' \n";
+  size_t trusted = 0;
+  uint64_t totalPredicted = 0, totalMeasured = 0;
+  for (size_t i = 0; i < comparisons.size(); ++i) {
+    const Comparison &comparison = comparisons[i];
+    if (comparison.getErrorRatio() <= Tolerance)
+      ++trusted;
+    totalPredicted = SaturatingAdd(totalPredicted, comparison.predicted);
+    totalMeasured = SaturatingAdd(totalMeasured, comparison.measured);
+    if (TopCount && i >= TopCount)
+      continue;
+
+    out << comparison.demangledName << ',' << comparison.mangledName
+        << ',' << comparison.calls << ',' << comparison.predicted << ',' << comparison.measured << ',';
+    /* Above 1 over-predicts, below 1 under-predicts */
+    if (!comparison.measured)
+      out << "inf";
+    else
+      out << format("%.3f", double(comparison.predicted) / comparison.measured);
+    out << ',' << comparison.getAbsoluteError() << '\n';
+  }
+
+  StringRef modelName = model == Model::Profile ? "profile" : model == Model::Loops ? "loops" : "static";
+  errs() << "Model: " << modelName << " ('" << staticColumnName << "')\n"
+         << "Functions compared: " << comparisons.size() << " (" << staticOnly
+         << " static-only functions skipped)\n"
+         << "Within " << format("%.2f", double(Tolerance)) << "x: " << trusted << " ("
+         << format("%.1f", comparisons.empty() ? 100.0 : 100.0 * trusted / comparisons.size()) << "%)\n"
+         << "Total predicted / measured: " << totalPredicted << " / " << totalMeasured << "\n";
+  return 0;
+}
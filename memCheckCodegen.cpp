@@ -0,0 +1,329 @@
+/**
+ * @file memCheckCodegen.cpp
+ * @brief Counts the memory accesses of the machine code the backend generates for a module.
+ *
+ * The IR counts of the memcheck pass cannot see what instruction selection and register allocation
+ * add: spills and reloads, stack protector checks, callee-saved register saves. This tool runs the
+ * codegen pipeline of the target up to the end of the machine passes (everything but emission) and
+ * counts every MachineInstr that may load or store, with the sizes of its MachineMemOperands.
+ * Accesses to spill slots are broken out, in total and inside machine loops, where register
+ * pressure costs the most bandwidth.
+ *
+ * With -ir-report the rows are joined by mangled name to a static report of the pass, which
+ * restricts the output to the functions of that report and adds their IR counts.
+ */
+#include "memCheckReport.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/CodeGen/MachineFrameInfo.h"
+#include "llvm/CodeGen/MachineFunction.h"
+#include "llvm/CodeGen/MachineFunctionPass.h"
+#include "llvm/CodeGen/MachineLoopInfo.h"
+#include "llvm/CodeGen/MachineMemOperand.h"
+#include "llvm/CodeGen/MachineModuleInfo.h"
+#include "llvm/CodeGen/PseudoSourceValue.h"
+#include "llvm/CodeGen/TargetPassConfig.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/InitializePasses.h"
+#include "llvm/MC/TargetRegistry.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Support/raw_ostream.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::opt<std::string> InputFileName(cl::Positional, cl::Required, cl::desc("<module.bc or module.ll>"));
+
+static cl::opt<std::string> OutputFileName(
+    "o", cl::desc("Output file (default = stdout)"), cl::value_desc("filename"), cl::init("-"));
+
+static cl::opt<std::string> IRReport(
+    "ir-report", cl::desc("Static report of the module to join with, e.g. static_function_analysis.csv"),
+    cl::value_desc("report.csv"), cl::init(""));
+
+static cl::opt<std::string> TargetTriple("mtriple", cl::desc("Target triple (default = the triple of the module)"));
+static cl::opt<std::string> TargetCPU("mcpu", cl::desc("Target CPU (default = generic)"), cl::init(""));
+static cl::opt<std::string> TargetFeatures("mattr", cl::desc("Target features, e.g. +avx2"), cl::init(""));
+
+static cl::opt<unsigned> OptLevel(
+    "O", cl::desc("Codegen optimization level, 0 to 3 (default = 2)"), cl::Prefix, cl::init(2));
+
+namespace {
+  /**
+   * @brief Machine-level counts of one function.
+   */
+  struct MachineCounts {
+    std::string mangledName;
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t bytes = 0;              /* Bytes of every access of known size, spills included */
+    uint64_t spills = 0;             /* Stores to spill slots */
+    uint64_t reloads = 0;            /* Loads from spill slots */
+    uint64_t spillBytes = 0;
+    uint64_t reloadBytes = 0;
+    uint64_t loopSpillBytes = 0;     /* Spill and reload bytes of instructions inside machine loops */
+    uint64_t stackProtectorAccesses = 0; /* Accesses to the stack protector slot */
+    uint64_t frameAccesses = 0;      /* Prologue and epilogue accesses, e.g. callee-saved registers */
+    uint64_t unknownSizeAccesses = 0; /* Accesses without a memory operand of known size */
+  };
+
+  /**
+   * @brief Counts the loads and stores of every machine function, after all machine passes.
+   */
+  class MachineAccessCounter : public MachineFunctionPass {
+  public:
+    static char ID;
+    std::vector<MachineCounts> &results;
+
+    explicit MachineAccessCounter(std::vector<MachineCounts> &results) : MachineFunctionPass(ID), results(results) {}
+
+    StringRef getPassName() const override { return "memcheck machine access counter"; }
+
+    void getAnalysisUsage(AnalysisUsage &AU) const override {
+      AU.addRequired<MachineLoopInfo>();
+      AU.setPreservesAll();
+      MachineFunctionPass::getAnalysisUsage(AU);
+    }
+
+    bool runOnMachineFunction(MachineFunction &MF) override {
+      const MachineFrameInfo &MFI = MF.getFrameInfo();
+      const MachineLoopInfo &MLI = getAnalysis<MachineLoopInfo>();
+      MachineCounts &counts = results.emplace_back();
+      counts.mangledName = MF.getName().str();
+
+      for (const MachineBasicBlock &MBB : MF) {
+        bool isInLoop = MLI.getLoopFor(&MBB) != nullptr;
+        for (const MachineInstr &MI : MBB) {
+          if (MI.isMetaInstruction() || (!MI.mayLoad() && !MI.mayStore()))
+            continue;
+          if (MI.getFlag(MachineInstr::FrameSetup) || MI.getFlag(MachineInstr::FrameDestroy))
+            counts.frameAccesses++;
+
+          /* Without memory operands only the direction is known, e.g. x86 push and pop */
+          if (MI.memoperands_empty()) {
+            counts.loads += MI.mayLoad();
+            counts.stores += MI.mayStore();
+            counts.unknownSizeAccesses++;
+            continue;
+          }
+          for (const MachineMemOperand *MMO : MI.memoperands()) {
+            uint64_t size = MMO->getSize();
+            bool isKnownSize = size != ~UINT64_C(0);
+            if (!isKnownSize)
+              counts.unknownSizeAccesses++;
+            uint64_t bytes = isKnownSize ? size : 0;
+
+            int frameIndex = 0;
+            bool isFixedStack = false;
+            if (const auto *stack = dyn_cast_or_null<FixedStackPseudoSourceValue>(MMO->getPseudoValue())) {
+              frameIndex = stack->getFrameIndex();
+              isFixedStack = true;
+            }
+            bool isSpillSlot = isFixedStack && MFI.isSpillSlotObjectIndex(frameIndex);
+            if (isFixedStack && MFI.hasStackProtectorIndex() && frameIndex == MFI.getStackProtectorIndex())
+              counts.stackProtectorAccesses++;
+
+            if (MMO->isLoad()) {
+              counts.loads++;
+              counts.bytes += bytes;
+              if (isSpillSlot) {
+                counts.reloads++;
+                counts.reloadBytes += bytes;
+              }
+            }
+            if (MMO->isStore()) {
+              counts.stores++;
+              counts.bytes += bytes;
+              if (isSpillSlot) {
+                counts.spills++;
+                counts.spillBytes += bytes;
+              }
+            }
+            if (isSpillSlot && isInLoop)
+              counts.loopSpillBytes += (MMO->isLoad() + MMO->isStore()) * bytes;
+          }
+        }
+      }
+      return false;
+    }
+  };
+
+  char MachineAccessCounter::ID = 0;
+
+  /**
+   * @brief IR counts of the functions of a static report, keyed by mangled name.
+   */
+  struct IRCounts {
+    StringRef loads, stores, bytes;  /* Raw CSV fields */
+  };
+
+  /**
+   * @brief Load the Loads, Stores and Bytes columns of a static report.
+   * @return false if the report cannot be read or lacks a column.
+   */
+  bool loadIRReport(StringRef fileName, std::unique_ptr<MemoryBuffer> &buffer, StringMap<IRCounts> &rows) {
+    auto file = MemoryBuffer::getFile(fileName);
+    if (!file) {
+      errs() << "Error: cannot read " << fileName << ": " << file.getError().message() << "\n";
+      return false;
+    }
+    buffer = std::move(*file);
+    line_iterator line(*buffer, /*SkipBlanks=*/true);
+    if (line.is_at_eof()) {
+      errs() << "Error: " << fileName << " is empty\n";
+      return false;
+    }
+    int loadsColumn = memcheckReport::findCSVColumn(*line, "Loads");
+    int storesColumn = memcheckReport::findCSVColumn(*line, "Stores");
+    int bytesColumn = memcheckReport::findCSVColumn(*line, "Bytes");
+    if (loadsColumn < 0 || storesColumn < 0 || bytesColumn < 0) {
+      errs() << "Error: " << fileName << " is not a static report (no Loads, Stores or Bytes column)\n";
+      return false;
+    }
+    for (++line; !line.is_at_eof(); ++line) {
+      StringRef key = memcheckReport::getCSVField(*line, memcheckReport::mangledNameColumn);
+      rows.try_emplace(memcheckReport::unquoteCSV(key),
+                       IRCounts{memcheckReport::getCSVField(*line, loadsColumn),
+                                memcheckReport::getCSVField(*line, storesColumn),
+                                memcheckReport::getCSVField(*line, bytesColumn)});
+    }
+    return true;
+  }
+
+  /**
+   * @brief Write a cell in CSV format, quoted like the reports of the pass.
+   */
+  void writeCSVCell(raw_ostream &out, StringRef cell) {
+    if (cell.find_first_of(",\"") == StringRef::npos) {
+      out << cell;
+      return;
+    }
+    out << '"';
+    for (char c : cell) {
+      if (c == '"')
+        out << '"';
+      out << c;
+    }
+    out << '"';
+  }
+} /* end of anonymous namespace */
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  InitializeAllTargets();
+  InitializeAllTargetMCs();
+  InitializeAllAsmPrinters();
+  InitializeAllAsmParsers();
+
+  /* The passes of the codegen pipeline, as llc registers them */
+  PassRegistry &registry = *PassRegistry::getPassRegistry();
+  initializeCore(registry);
+  initializeCodeGen(registry);
+  initializeLoopStrengthReducePass(registry);
+  initializeLowerIntrinsicsPass(registry);
+  initializeUnreachableBlockElimLegacyPassPass(registry);
+  initializeConstantHoistingLegacyPassPass(registry);
+  initializeScalarOpts(registry);
+  initializeVectorization(registry);
+  initializeScalarizeMaskedMemIntrinLegacyPassPass(registry);
+  initializeExpandReductionsPass(registry);
+  initializeTransformUtils(registry);
+
+  cl::ParseCommandLineOptions(argc, argv, "memcheck machine code access counter\n");
+
+  std::unique_ptr<MemoryBuffer> reportBuffer;
+  StringMap<IRCounts> irRows;
+  if (!IRReport.empty() && !loadIRReport(IRReport, reportBuffer, irRows))
+    return 1;
+
+  LLVMContext context;
+  SMDiagnostic error;
+  std::unique_ptr<Module> module = parseIRFile(InputFileName, error, context);
+  if (!module) {
+    error.print(argv[0], errs());
+    return 1;
+  }
+
+  Triple triple(TargetTriple.empty() ? module->getTargetTriple() : TargetTriple);
+  if (triple.getTriple().empty())
+    triple.setTriple(sys::getDefaultTargetTriple());
+  std::string message;
+  const Target *target = TargetRegistry::lookupTarget(triple.getTriple(), message);
+  if (!target) {
+    errs() << "Error: " << message << "\n";
+    return 1;
+  }
+  CodeGenOpt::Level level = OptLevel == 0   ? CodeGenOpt::None
+                            : OptLevel == 1 ? CodeGenOpt::Less
+                            : OptLevel == 2 ? CodeGenOpt::Default
+                                            : CodeGenOpt::Aggressive;
+  std::unique_ptr<TargetMachine> targetMachine(target->createTargetMachine(
+      triple.getTriple(), TargetCPU, TargetFeatures, TargetOptions(), {}, {}, level));
+  if (!targetMachine) {
+    errs() << "Error: cannot create a target machine for " << triple.getTriple() << "\n";
+    return 1;
+  }
+  module->setTargetTriple(triple.getTriple());
+  module->setDataLayout(targetMachine->createDataLayout());
+
+  /* Instruction selection and every machine pass, then the counter instead of the emission */
+  auto &LLVMTM = static_cast<LLVMTargetMachine &>(*targetMachine);
+  std::vector<MachineCounts> results;
+  legacy::PassManager PM;
+  auto *MMIWP = new MachineModuleInfoWrapperPass(&LLVMTM);
+  TargetPassConfig *passConfig = LLVMTM.createPassConfig(PM);
+  PM.add(passConfig);
+  PM.add(MMIWP);
+  if (passConfig->addISelPasses()) {
+    errs() << "Error: the target cannot select instructions for " << InputFileName << "\n";
+    return 1;
+  }
+  passConfig->addMachinePasses();
+  passConfig->setInitialized();
+  PM.add(new MachineAccessCounter(results));
+  PM.run(*module);
+
+  std::error_code EC;
+  raw_fd_ostream out(OutputFileName, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Error: cannot open " << OutputFileName << ": " << EC.message() << "\n";
+    return 1;
+  }
+  out << "'Function Name (Demangled)','Function Name (Mangled)','Machine Loads','Machine Stores','Machine Bytes'"
+      << ",'Spills','Reloads','Spill Bytes','Reload Bytes','Loop Spill Bytes','Stack Protector Accesses'"
+      << ",'Frame Accesses','Unknown Size Accesses'";
+  if (!IRReport.empty())
+    out << ",'IR Loads','IR Stores','IR Bytes'";
+  out << " \n";
+  for (const MachineCounts &counts : results) {
+    auto irRow = irRows.find(counts.mangledName);
+    if (!IRReport.empty() && irRow == irRows.end())
+      continue;
+    writeCSVCell(out, demangle(counts.mangledName));
+    out << ',';
+    writeCSVCell(out, counts.mangledName);
+    out << ',' << counts.loads << ',' << counts.stores << ',' << counts.bytes
+        << ',' << counts.spills << ',' << counts.reloads << ',' << counts.spillBytes << ',' << counts.reloadBytes
+        << ',' << counts.loopSpillBytes << ',' << counts.stackProtectorAccesses << ',' << counts.frameAccesses
+        << ',' << counts.unknownSizeAccesses;
+    if (!IRReport.empty())
+      out << ',' << irRow->second.loads.trim() << ',' << irRow->second.stores.trim() << ',' << irRow->second.bytes.trim();
+    out << '\n';
+  }
+  return 0;
+}
@@ -0,0 +1,375 @@
+/**
+ * @file memCheckLink.cpp
+ * @brief Whole-program roll-up of the module summaries recorded by the memcheck pass.
+ *
+ * Every translation unit compiled with -memcheck-summary carries the self metrics and the direct
+ * callees of its functions in named metadata (see memCheckReport.h). At link time this tool reads
+ * only that metadata from the bitcode inputs (function bodies are never materialized), resolves
+ * the callees across translation units by mangled name and computes the inclusive metrics of the
+ * whole call graph once, so calls into other translation units count as well. Functions are
+ * ranked by inclusive bytes.
+ *
+ * Functions emitted in many translation units (inline functions, template instantiations) keep the
+ * summary of their first input, like memcheck-merge. Functions of local linkage are distinct per
+ * input even when their names are not, and calls resolve to the local function of the caller's
+ * input first. Callees without a summary (external libraries) contribute nothing.
+ */
+#include "memCheckReport.h"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/ADT/Twine.h"
+#include "llvm/Demangle/Demangle.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/Metadata.h"
+#include "llvm/IR/Module.h"
+#include "llvm/IRReader/IRReader.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/SourceMgr.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> Inputs(
+    cl::Positional, cl::OneOrMore, cl::desc("<bitcode file>... (or @response file)"));
+
+static cl::opt<std::string> OutputFileName(
+    "o", cl::desc("Output file (default = stdout)"), cl::value_desc("filename"), cl::init("-"));
+
+static cl::opt<unsigned> TopCount("n", cl::desc("Number of functions to list (default = all)"), cl::init(0));
+
+static cl::opt<bool> AllFunctions(
+    "all", cl::desc("List every function, not only the user-defined ones"), cl::init(false));
+
+static cl::opt<unsigned> RecursionIterations(
+    "recursion-iterations",
+    cl::desc("Fixed-point iterations used to estimate recursive call graph SCCs (default = 8)"),
+    cl::init(8));
+
+namespace {
+  /**
+   * @brief Loads, stores and bytes of a function, self or inclusive.
+   */
+  struct Totals {
+    uint64_t loads = 0;
+    uint64_t stores = 0;
+    uint64_t bytes = 0;
+
+    /* Add Weight times Other, saturating instead of overflowing */
+    void addWeighted(const Totals &other, uint64_t weight) {
+      loads = SaturatingAdd(loads, SaturatingMultiply(other.loads, weight));
+      stores = SaturatingAdd(stores, SaturatingMultiply(other.stores, weight));
+      bytes = SaturatingAdd(bytes, SaturatingMultiply(other.bytes, weight));
+    }
+
+    bool operator==(const Totals &other) const {
+      return loads == other.loads && stores == other.stores && bytes == other.bytes;
+    }
+  };
+
+  /**
+   * @brief A function of the whole program, with its calls.
+   */
+  struct Node {
+    StringRef mangledName;
+    StringRef moduleName;      /* First input that defines the function */
+    Totals self;
+    Totals inclusive;
+    bool isUserDefined = false;
+    unsigned translationUnits = 0;
+    std::vector<std::pair<StringRef, uint64_t>> calls;     /* Callee names and weights, as recorded */
+    std::vector<std::pair<unsigned, uint64_t>> callees;    /* Resolved callees and weights */
+  };
+
+  /**
+   * @brief The program being linked: every summarized function, by mangled name, or by module
+   *        and mangled name for functions of local linkage.
+   */
+  struct Program {
+    BumpPtrAllocator allocator;
+    StringSaver saver{allocator};
+    std::vector<Node> nodes;
+    StringMap<unsigned> nodeIndex;
+    StringMap<unsigned> localNodeIndex;  /* By getLocalKey */
+    size_t modules = 0;
+    size_t malformedEntries = 0;
+
+    /**
+     * @brief Get the key of a function of local linkage; NUL never appears in a file name.
+     */
+    static std::string getLocalKey(StringRef moduleName, StringRef name) {
+      return (moduleName + Twine('\0') + name).str();
+    }
+
+    /**
+     * @brief Read the summary of one bitcode file.
+     * @return false if the file cannot be read.
+     */
+    bool read(StringRef fileName) {
+      /* One context per input, so memory does not grow with the number of inputs */
+      LLVMContext context;
+      SMDiagnostic error;
+      std::unique_ptr<Module> module = getLazyIRFileModule(fileName, error, context);
+      if (!module) {
+        errs() << "Error: cannot read " << fileName << ": " << error.getMessage() << "\n";
+        return false;
+      }
+      if (Error E = module->materializeMetadata()) {
+        errs() << "Error: cannot read the metadata of " << fileName << ": " << toString(std::move(E)) << "\n";
+        return false;
+      }
+      NamedMDNode *summary = module->getNamedMetadata(MEMCHECK_SUMMARY_METADATA);
+      if (!summary) {
+        errs() << "Warning: " << fileName << " has no memcheck summary (compile it with -memcheck-summary)\n";
+        return true;
+      }
+
+      ++modules;
+      StringRef moduleName = saver.save(fileName);
+      for (const MDNode *entry : summary->operands()) {
+        if (!readEntry(entry, moduleName))
+          ++malformedEntries;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Add a function of a summary; the first summary of a name (of a module and name, for
+     *        local linkage) wins.
+     * @return false if the entry is malformed.
+     */
+    bool readEntry(const MDNode *entry, StringRef moduleName) {
+      if (entry->getNumOperands() != 7)
+        return false;
+      auto *name = dyn_cast<MDString>(entry->getOperand(0));
+      auto *calls = dyn_cast<MDTuple>(entry->getOperand(6));
+      if (!name || !calls || calls->getNumOperands() % 2)
+        return false;
+      uint64_t counters[5];
+      for (unsigned i = 0; i < 5; ++i) {
+        auto *counter = mdconst::dyn_extract_or_null<ConstantInt>(entry->getOperand(i + 1));
+        if (!counter)
+          return false;
+        counters[i] = counter->getZExtValue();
+      }
+
+      bool isLocal = counters[4] != 0;
+      auto inserted = isLocal
+          ? localNodeIndex.try_emplace(getLocalKey(moduleName, name->getString()), unsigned(nodes.size()))
+          : nodeIndex.try_emplace(name->getString(), unsigned(nodes.size()));
+      if (!inserted.second) {
+        nodes[inserted.first->second].translationUnits++;
+        return true;
+      }
+      Node &node = nodes.emplace_back();
+      node.mangledName = isLocal ? saver.save(name->getString()) : inserted.first->getKey();
+      node.moduleName = moduleName;
+      node.self = {counters[0], counters[1], counters[2]};
+      node.isUserDefined = counters[3] != 0;
+      node.translationUnits = 1;
+      for (unsigned i = 0; i < calls->getNumOperands(); i += 2) {
+        auto *callee = dyn_cast<MDString>(calls->getOperand(i));
+        auto *weight = mdconst::dyn_extract_or_null<ConstantInt>(calls->getOperand(i + 1));
+        if (callee && weight)
+          node.calls.push_back({saver.save(callee->getString()), weight->getZExtValue()});
+      }
+      return true;
+    }
+
+    /**
+     * @brief Resolve the callees by name once every input is read, local functions of the
+     *        caller's module first.
+     * @return The number of calls to functions without a summary.
+     */
+    size_t resolveCalls() {
+      size_t unresolved = 0;
+      for (Node &node : nodes) {
+        for (const auto &call : node.calls) {
+          auto callee = localNodeIndex.find(getLocalKey(node.moduleName, call.first));
+          if (callee == localNodeIndex.end())
+            callee = nodeIndex.find(call.first);
+          if (callee == nodeIndex.end())
+            ++unresolved;
+          else
+            node.callees.push_back({callee->second, call.second});
+        }
+        node.calls = {};
+      }
+      return unresolved;
+    }
+
+    /**
+     * @brief Compute the inclusive metrics of every function, one SCC at a time, callees first.
+     *
+     * Same model as the -memcheck-inclusive roll-up of the pass: calls out of an SCC add the final
+     * inclusive totals of the callee times the call weight, and recursive SCCs are solved by
+     * iterating the call equations up to -recursion-iterations times.
+     */
+    void computeInclusiveMetrics() {
+      constexpr unsigned unvisited = std::numeric_limits<unsigned>::max();
+      std::vector<unsigned> index(nodes.size(), unvisited), lowLink(nodes.size());
+      std::vector<char> isOnStack(nodes.size());
+      std::vector<unsigned> stack;
+      std::vector<std::pair<unsigned, size_t>> frames;  /* Node and next callee, of Tarjan's walk */
+      unsigned nextIndex = 0;
+
+      auto visit = [&](unsigned node) {
+        index[node] = lowLink[node] = nextIndex++;
+        stack.push_back(node);
+        isOnStack[node] = true;
+        frames.push_back({node, 0});
+      };
+
+      for (unsigned root = 0; root < nodes.size(); ++root) {
+        if (index[root] != unvisited)
+          continue;
+        visit(root);
+        while (!frames.empty()) {
+          unsigned node = frames.back().first;
+          size_t edge = frames.back().second++;
+          if (edge < nodes[node].callees.size()) {
+            unsigned callee = nodes[node].callees[edge].first;
+            if (index[callee] == unvisited)
+              visit(callee);
+            else if (isOnStack[callee])
+              lowLink[node] = std::min(lowLink[node], index[callee]);
+            continue;
+          }
+
+          frames.pop_back();
+          if (!frames.empty())
+            lowLink[frames.back().first] = std::min(lowLink[frames.back().first], lowLink[node]);
+          if (lowLink[node] != index[node])
+            continue;
+
+          /* Pop the SCC; every callee outside of it is final */
+          std::vector<unsigned> members;
+          do {
+            members.push_back(stack.back());
+            isOnStack[stack.back()] = false;
+            stack.pop_back();
+          } while (members.back() != node);
+          solveSCC(members);
+        }
+      }
+    }
+
+    void solveSCC(const std::vector<unsigned> &members) {
+      auto isMember = [&](unsigned node) { return llvm::is_contained(members, node); };
+      std::vector<Totals> base(members.size());
+      bool isRecursive = false;
+      for (size_t i = 0; i < members.size(); ++i) {
+        const Node &node = nodes[members[i]];
+        base[i] = node.self;
+        for (const auto &callee : node.callees) {
+          if (isMember(callee.first))
+            isRecursive = true;
+          else
+            base[i].addWeighted(nodes[callee.first].inclusive, callee.second);
+        }
+      }
+      for (size_t i = 0; i < members.size(); ++i)
+        nodes[members[i]].inclusive = base[i];
+
+      /* Bounded fixed point for recursive SCCs */
+      for (unsigned iteration = 0; isRecursive && iteration < RecursionIterations; ++iteration) {
+        std::vector<Totals> next = base;
+        for (size_t i = 0; i < members.size(); ++i) {
+          for (const auto &callee : nodes[members[i]].callees) {
+            if (isMember(callee.first))
+              next[i].addWeighted(nodes[callee.first].inclusive, callee.second);
+          }
+        }
+        bool changed = false;
+        for (size_t i = 0; i < members.size(); ++i) {
+          changed |= !(next[i] == nodes[members[i]].inclusive);
+          nodes[members[i]].inclusive = next[i];
+        }
+        if (!changed)
+          break;
+      }
+    }
+  };
+
+  /**
+   * @brief Write a cell in CSV format, quoted like the reports of the pass.
+   */
+  void writeCSVCell(raw_ostream &out, StringRef cell) {
+    if (cell.find_first_of(",\"") == StringRef::npos) {
+      out << cell;
+      return;
+    }
+    out << '"';
+    for (char c : cell) {
+      if (c == '"')
+        out << '"';
+      out << c;
+    }
+    out << '"';
+  }
+} /* end of anonymous namespace */
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "memcheck whole-program summary roll-up\n");
+
+  Program program;
+  for (const std::string &input : Inputs) {
+    if (!program.read(input))
+      return 1;
+  }
+  size_t unresolved = program.resolveCalls();
+  program.computeInclusiveMetrics();
+
+  /* Hottest first by inclusive bytes, then by self bytes */
+  std::vector<const Node *> ranking;
+  for (const Node &node : program.nodes) {
+    if (node.isUserDefined || AllFunctions)
+      ranking.push_back(&node);
+  }
+  std::stable_sort(ranking.begin(), ranking.end(), [](const Node *a, const Node *b) {
+    if (a->inclusive.bytes != b->inclusive.bytes)
+      return a->inclusive.bytes > b->inclusive.bytes;
+    return a->self.bytes > b->self.bytes;
+  });
+
+  std::error_code EC;
+  raw_fd_ostream out(OutputFileName, EC, sys::fs::OF_Text);
+  if (EC) {
+    errs() << "Error: cannot open " << OutputFileName << ": " << EC.message() << "\n";
+    return 1;
+  }
+  out << "'Function Name (Demangled)','Function Name (Mangled)','Loads','Stores','Bytes','Inclusive Loads'"
+      << ",'Inclusive Stores','Inclusive Bytes','Translation Units','Module' \n";
+  for (size_t i = 0; i < ranking.size() && (!TopCount || i < TopCount); ++i) {
+    const Node &node = *ranking[i];
+    writeCSVCell(out, demangle(node.mangledName.str()));
+    out << ',';
+    writeCSVCell(out, node.mangledName);
+    out << ',' << node.self.loads << ',' << node.self.stores << ',' << node.self.bytes
+        << ',' << node.inclusive.loads << ',' << node.inclusive.stores << ',' << node.inclusive.bytes
+        << ',' << node.translationUnits << ',';
+    writeCSVCell(out, node.moduleName);
+    out << '\n';
+  }
+
+  errs() << "Modules summarized: " << program.modules << " of " << Inputs.size() << "\n"
+         << "Functions: " << program.nodes.size() << " (" << ranking.size() << " listed)\n"
+         << "Calls without a summary: " << unresolved << "\n";
+  if (program.malformedEntries)
+    errs() << "Warning: " << program.malformedEntries << " malformed summary entries skipped\n";
+  return 0;
+}
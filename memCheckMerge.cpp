@@ -0,0 +1,298 @@
+/**
+ * @file memCheckMerge.cpp
+ * @brief Merges the per-module CSV reports of the memcheck pass into one deduplicated report.
+ *
+ * Functions emitted in many translation units (inline functions, template instantiations) are
+ * deduplicated by mangled name; the first row in input order is kept and a 'Translation Units'
+ * column counts the reports the function appeared in. Rows are sorted by mangled name with an
+ * external merge sort, so memory stays bounded by -memory-limit however many reports are merged.
+ */
+#include "memCheckReport.h"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Allocator.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/FileUtilities.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/StringSaver.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <memory>
+#include <queue>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+
+static cl::list<std::string> Inputs(
+    cl::Positional, cl::OneOrMore,
+    cl::desc("<report.csv or directory of reports>..."));
+
+static cl::opt<std::string> OutputFileName(
+    "o", cl::desc("Output file (default = stdout)"), cl::value_desc("filename"), cl::init("-"));
+
+static cl::opt<unsigned> MemoryLimit(
+    "memory-limit",
+    cl::desc("Megabytes of rows buffered before a sorted run is spilled to disk (default = 256, minimum = 1)"),
+    cl::init(256));
+
+namespace {
+  /**
+   * @brief A row of a report, keyed by its (raw) mangled name.
+   */
+  struct Row {
+    StringRef key;
+    StringRef line;
+  };
+
+  /**
+   * @brief A sorted run of rows, either spilled to a temporary file or kept in memory.
+   */
+  struct Run {
+    std::unique_ptr<MemoryBuffer> buffer;
+    line_iterator line;
+    StringRef key;
+
+    explicit Run(std::unique_ptr<MemoryBuffer> runBuffer)
+        : buffer(std::move(runBuffer)), line(*buffer, /*SkipBlanks=*/true) {
+      updateKey();
+    }
+
+    bool isAtEnd() const { return line.is_at_eof(); }
+
+    void next() {
+      ++line;
+      updateKey();
+    }
+
+    void updateKey() {
+      if (!isAtEnd())
+        key = memcheckReport::getCSVField(*line, memcheckReport::mangledNameColumn);
+    }
+  };
+
+  /**
+   * @brief External merge sort of report rows by mangled name.
+   */
+  class ReportMerger {
+  private:
+    BumpPtrAllocator allocator;
+    StringSaver saver{allocator};
+    std::vector<Row> rows;
+    size_t bufferedBytes = 0;
+
+    std::vector<std::string> runFiles;
+    std::vector<std::unique_ptr<FileRemover>> runRemovers;
+    std::string lastRun;
+
+    std::string header;
+    std::string headerFile;
+
+    /**
+     * @brief Sort the buffered rows by key; rows with the same key stay in input order.
+     */
+    void sortRows() {
+      std::stable_sort(rows.begin(), rows.end(),
+                       [](const Row &a, const Row &b) { return a.key < b.key; });
+    }
+
+    /**
+     * @brief Sort the buffered rows and write them to a new temporary run file.
+     * @return false if the run file cannot be written.
+     */
+    bool spill() {
+      sortRows();
+      int FD;
+      SmallString<256> path;
+      if (std::error_code EC = sys::fs::createTemporaryFile("memcheck-merge", "run", FD, path)) {
+        errs() << "Error: cannot create a temporary run file: " << EC.message() << "\n";
+        return false;
+      }
+      runFiles.push_back(std::string(path.str()));
+      runRemovers.push_back(std::make_unique<FileRemover>(path));
+
+      raw_fd_ostream runFile(FD, /*shouldClose=*/true);
+      for (const Row &row : rows)
+        runFile << row.line << '\n';
+      runFile.close();
+      if (runFile.has_error()) {
+        errs() << "Error: cannot write the temporary run file " << path << "\n";
+        return false;
+      }
+
+      rows.clear();
+      allocator.Reset();
+      bufferedBytes = 0;
+      return true;
+    }
+
+  public:
+    /**
+     * @brief Add the rows of one per-module report.
+     * @param fileName The report file.
+     * @return false if the report cannot be read or its columns differ from the other reports.
+     */
+    bool addReport(StringRef fileName) {
+      auto buffer = MemoryBuffer::getFile(fileName);
+      if (!buffer) {
+        errs() << "Error: cannot read " << fileName << ": " << buffer.getError().message() << "\n";
+        return false;
+      }
+
+      line_iterator line(**buffer, /*SkipBlanks=*/true);
+      /* Modules without user-defined functions leave an empty report */
+      if (line.is_at_eof())
+        return true;
+
+      StringRef reportHeader = line->rtrim();
+      if (header.empty()) {
+        header = reportHeader.str();
+        headerFile = fileName.str();
+      } else if (reportHeader != header) {
+        errs() << "Error: the columns of " << fileName << " differ from those of " << headerFile
+               << "; merge reports produced with the same options\n";
+        return false;
+      }
+
+      for (++line; !line.is_at_eof(); ++line) {
+        StringRef saved = saver.save(*line);
+        rows.push_back({memcheckReport::getCSVField(saved, memcheckReport::mangledNameColumn), saved});
+        bufferedBytes += saved.size() + sizeof(Row);
+        if (bufferedBytes >= std::max<size_t>(MemoryLimit, 1) * 1024 * 1024 && !spill())
+          return false;
+      }
+      return true;
+    }
+
+    /**
+     * @brief Merge all runs and write the deduplicated report.
+     * @param out The output stream.
+     * @return false if a run file cannot be read back.
+     */
+    bool write(raw_ostream &out) {
+      if (header.empty())
+        return true;
+      out << header << ",'Translation Units'\n";
+
+      std::vector<std::unique_ptr<Run>> runs;
+      for (const std::string &runFile : runFiles) {
+        auto buffer = MemoryBuffer::getFile(runFile);
+        if (!buffer) {
+          errs() << "Error: cannot read back " << runFile << ": " << buffer.getError().message() << "\n";
+          return false;
+        }
+        runs.push_back(std::make_unique<Run>(std::move(*buffer)));
+      }
+
+      /* The last, partial chunk is merged from memory */
+      sortRows();
+      for (const Row &row : rows) {
+        lastRun += row.line;
+        lastRun += '\n';
+      }
+      rows.clear();
+      allocator.Reset();
+      runs.push_back(std::make_unique<Run>(MemoryBuffer::getMemBuffer(lastRun, "<memory>")));
+
+      /* Runs hold consecutive input rows, so ties go to the lower run index */
+      auto isAfter = [&](size_t a, size_t b) {
+        return runs[a]->key != runs[b]->key ? runs[a]->key > runs[b]->key : a > b;
+      };
+      std::priority_queue<size_t, std::vector<size_t>, decltype(isAfter)> queue(isAfter);
+      for (size_t i = 0; i < runs.size(); ++i) {
+        if (!runs[i]->isAtEnd())
+          queue.push(i);
+      }
+
+      std::string current;
+      std::string currentKey;
+      size_t translationUnits = 0;
+      auto flush = [&]() {
+        if (translationUnits)
+          out << current << ',' << translationUnits << '\n';
+      };
+
+      while (!queue.empty()) {
+        size_t index = queue.top();
+        queue.pop();
+        Run &run = *runs[index];
+        if (!translationUnits || run.key != currentKey) {
+          flush();
+          current = run.line->str();
+          currentKey = run.key.str();
+          translationUnits = 0;
+        }
+        ++translationUnits;
+
+        run.next();
+        if (!run.isAtEnd())
+          queue.push(index);
+      }
+      flush();
+      return true;
+    }
+  };
+
+  /**
+   * @brief Expand the inputs into report files; directories are searched recursively for *.csv.
+   * @param files The report files, directory contents sorted by path.
+   * @return false if an input does not exist.
+   */
+  bool collectReports(std::vector<std::string> &files) {
+    for (const std::string &input : Inputs) {
+      if (!sys::fs::is_directory(input)) {
+        if (!sys::fs::exists(input)) {
+          errs() << "Error: " << input << " does not exist\n";
+          return false;
+        }
+        files.push_back(input);
+        continue;
+      }
+
+      std::vector<std::string> found;
+      std::error_code EC;
+      for (sys::fs::recursive_directory_iterator it(input, EC), end; it != end && !EC; it.increment(EC)) {
+        if (sys::path::extension(it->path()) == ".csv" && !sys::fs::is_directory(it->path()))
+          found.push_back(it->path());
+      }
+      if (EC) {
+        errs() << "Error: cannot read the directory " << input << ": " << EC.message() << "\n";
+        return false;
+      }
+      std::sort(found.begin(), found.end());
+      files.insert(files.end(), found.begin(), found.end());
+    }
+    return true;
+  }
+} /* end of anonymous namespace */
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "memcheck report merger\n");
+
+  std::vector<std::string> files;
+  if (!collectReports(files))
+    return 1;
+
+  ReportMerger merger;
+  for (const std::string &file : files) {
+    if (!merger.addReport(file))
+      return 1;
+  }
+
+  std::error_code EC;
+  raw_fd_ostream out(OutputFileName, EC, sys::fs::OF_None);
+  if (EC) {
+    errs() << "Error: cannot open " << OutputFileName << ": " << EC.message() << "\n";
+    return 1;
+  }
+  if (!merger.write(out))
+    return 1;
+  return 0;
+}
@@ -0,0 +1,409 @@
+/**
+ * @file memCheckQuery.cpp
+ * @brief Queries the binary columnar reports (.mcr) of the memcheck pass.
+ *
+ * Reports are memory-mapped and only the columns a query touches are read, so ranking or
+ * filtering a report of a large code base does not parse the whole file.
+ *
+ *   memcheck-query top -n 20 -by 'Dynamic Bytes' report.mcr
+ *   memcheck-query filter -where 'Atomics>0' -name foo report.mcr
+ *   memcheck-query diff -by Bytes old.mcr new.mcr
+ */
+#include "memCheckReport.h"
+
+#include "llvm/ADT/ArrayRef.h"
+#include "llvm/ADT/StringMap.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/InitLLVM.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/raw_ostream.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <numeric>
+#include <optional>
+#include <string>
+#include <vector>
+
+using namespace llvm;
+using namespace memcheckReport;
+
+static cl::SubCommand TopCommand("top", "List the functions with the largest value of a column");
+static cl::SubCommand FilterCommand("filter", "List the functions matching conditions, as CSV");
+static cl::SubCommand DiffCommand("diff", "List the functions whose column changed between two reports");
+
+static cl::opt<std::string> TopInput(cl::Positional, cl::Required, cl::desc("<report.mcr>"),
+                                     cl::sub(TopCommand));
+static cl::opt<unsigned> TopCount("n", cl::desc("Number of functions to list (default = 10)"),
+                                  cl::init(10), cl::sub(TopCommand));
+
+static cl::list<std::string> FilterInputs(cl::Positional, cl::OneOrMore, cl::desc("<report.mcr>..."),
+                                          cl::sub(FilterCommand));
+static cl::list<std::string> Conditions(
+    "where", cl::desc("Condition on a numeric column: <column><op><value>, op is one of = != < <= > >="),
+    cl::value_desc("condition"), cl::sub(FilterCommand));
+static cl::opt<std::string> NameFilter("name", cl::desc("Only list functions whose name contains this string"),
+                                       cl::value_desc("substring"), cl::sub(FilterCommand));
+
+static cl::opt<std::string> DiffOld(cl::Positional, cl::Required, cl::desc("<old.mcr>"), cl::sub(DiffCommand));
+static cl::opt<std::string> DiffNew(cl::Positional, cl::Required, cl::desc("<new.mcr>"), cl::sub(DiffCommand));
+static cl::opt<unsigned> DiffCount("n", cl::desc("Number of functions to list (default = all)"),
+                                   cl::init(0), cl::sub(DiffCommand));
+
+static cl::opt<std::string> SortColumn("by", cl::desc("Column to rank by (default = Bytes)"),
+                                       cl::value_desc("column"), cl::init("Bytes"),
+                                       cl::sub(TopCommand), cl::sub(DiffCommand));
+
+namespace {
+  /**
+   * @brief A memory-mapped binary report.
+   */
+  class Report {
+  private:
+    std::unique_ptr<MemoryBuffer> buffer;
+    const BinaryHeader *header = nullptr;
+    ArrayRef<BinaryColumn> columns;
+    StringRef strings;
+
+    bool fail(const Twine &message) {
+      errs() << "Error: " << buffer->getBufferIdentifier() << ": " << message << "\n";
+      return false;
+    }
+
+    bool isInBounds(uint64_t offset, uint64_t size) const {
+      return offset <= buffer->getBufferSize() && size <= buffer->getBufferSize() - offset;
+    }
+
+  public:
+    /**
+     * @brief Map a report and validate its layout.
+     * @param fileName The report file.
+     * @return false if the report cannot be read or is malformed.
+     */
+    bool open(StringRef fileName) {
+      auto mapped = MemoryBuffer::getFile(fileName, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+      if (!mapped) {
+        errs() << "Error: cannot read " << fileName << ": " << mapped.getError().message() << "\n";
+        return false;
+      }
+      buffer = std::move(*mapped);
+
+      const char *data = buffer->getBufferStart();
+      if (!isInBounds(0, sizeof(BinaryHeader)) || std::memcmp(data, binaryMagic, sizeof(binaryMagic)) != 0)
+        return fail("not a memcheck binary report");
+      header = reinterpret_cast<const BinaryHeader *>(data);
+      if (header->version != binaryVersion)
+        return fail("unsupported report version " + Twine(uint32_t(header->version)));
+      if (!isInBounds(sizeof(BinaryHeader), uint64_t(header->columnCount) * sizeof(BinaryColumn)))
+        return fail("truncated column directory");
+      columns = ArrayRef<BinaryColumn>(reinterpret_cast<const BinaryColumn *>(data + sizeof(BinaryHeader)),
+                                       header->columnCount);
+      if (!isInBounds(header->stringTableOffset, header->stringTableSize))
+        return fail("truncated string table");
+      strings = StringRef(data + header->stringTableOffset, header->stringTableSize);
+      if (!strings.empty() && strings.back() != '\0')
+        return fail("unterminated string table");
+
+      for (const BinaryColumn &column : columns) {
+        if (column.type > uint32_t(ColumnType::Flag))
+          return fail("unknown column type " + Twine(uint32_t(column.type)));
+        if (column.nameOffset >= strings.size())
+          return fail("column name out of bounds");
+        uint64_t width = getColumnWidth(ColumnType(uint32_t(column.type)));
+        if (header->rowCount > buffer->getBufferSize() / width ||
+            !isInBounds(column.dataOffset, header->rowCount * width))
+          return fail("column " + getColumnName(&column - columns.begin()) + " out of bounds");
+      }
+      if (columns.size() <= mangledNameColumn || getColumnType(0) != ColumnType::String ||
+          getColumnType(mangledNameColumn) != ColumnType::String)
+        return fail("missing function name columns");
+      return true;
+    }
+
+    StringRef getFileName() const { return buffer->getBufferIdentifier(); }
+    uint64_t getRowCount() const { return header->rowCount; }
+    size_t getColumnCount() const { return columns.size(); }
+
+    ColumnType getColumnType(size_t column) const { return ColumnType(uint32_t(columns[column].type)); }
+
+    StringRef getString(uint64_t offset) const {
+      if (offset >= strings.size())
+        return "<invalid>";
+      return StringRef(strings.data() + offset);
+    }
+
+    StringRef getColumnName(size_t column) const { return getString(columns[column].nameOffset); }
+
+    /**
+     * @brief Find a column by name.
+     * @return The column index, or std::nullopt (with an error printed) if there is no such column.
+     */
+    std::optional<size_t> findColumn(StringRef name) const {
+      for (size_t i = 0; i < columns.size(); ++i) {
+        if (getColumnName(i) == name)
+          return i;
+      }
+      errs() << "Error: " << getFileName() << " has no column '" << name << "'\n";
+      return std::nullopt;
+    }
+
+    /**
+     * @brief Find a numeric (Counter or Flag) column by name.
+     */
+    std::optional<size_t> findNumericColumn(StringRef name) const {
+      std::optional<size_t> column = findColumn(name);
+      if (column && getColumnType(*column) == ColumnType::String) {
+        errs() << "Error: column '" << name << "' is not numeric\n";
+        return std::nullopt;
+      }
+      return column;
+    }
+
+    uint64_t getValue(size_t column, uint64_t row) const {
+      const char *cells = buffer->getBufferStart() + columns[column].dataOffset;
+      return support::endian::read64le(cells + row * 8);
+    }
+
+    StringRef getStringCell(size_t column, uint64_t row) const {
+      const char *cells = buffer->getBufferStart() + columns[column].dataOffset;
+      return getString(support::endian::read32le(cells + row * 4));
+    }
+
+    StringRef getDemangledName(uint64_t row) const { return getStringCell(0, row); }
+    StringRef getMangledName(uint64_t row) const { return getStringCell(mangledNameColumn, row); }
+  };
+
+  /**
+   * @brief A condition of the filter command, on a numeric column.
+   */
+  struct Condition {
+    enum Op { EQ, NE, LT, LE, GT, GE };
+    std::string column;
+    Op op;
+    uint64_t value;
+
+    bool matches(uint64_t cell) const {
+      switch (op) {
+        case EQ: return cell == value;
+        case NE: return cell != value;
+        case LT: return cell < value;
+        case LE: return cell <= value;
+        case GT: return cell > value;
+        case GE: return cell >= value;
+      }
+      return false;
+    }
+  };
+
+  /**
+   * @brief Parse a -where condition such as 'Atomics>0'.
+   * @return The condition, or std::nullopt (with an error printed) if it is malformed.
+   */
+  std::optional<Condition> parseCondition(StringRef text) {
+    static const std::pair<StringRef, Condition::Op> ops[] = {
+      {"!=", Condition::NE}, {"<=", Condition::LE}, {">=", Condition::GE},
+      {"=", Condition::EQ},  {"<", Condition::LT},  {">", Condition::GT},
+    };
+    /* The first operator character splits the condition, two-character operators first */
+    size_t split = text.find_first_of("!=<>");
+    if (split != StringRef::npos) {
+      for (const auto &op : ops) {
+        if (!text.drop_front(split).startswith(op.first))
+          continue;
+        Condition condition;
+        condition.column = text.take_front(split).trim().str();
+        condition.op = op.second;
+        StringRef value = text.drop_front(split + op.first.size()).trim();
+        if (value == "true")
+          condition.value = 1;
+        else if (value == "false")
+          condition.value = 0;
+        else if (value.getAsInteger(10, condition.value))
+          break;
+        return condition;
+      }
+    }
+    errs() << "Error: malformed condition '" << text << "', expected <column><op><value>\n";
+    return std::nullopt;
+  }
+
+  void printValue(raw_ostream &OS, const Report &report, size_t column, uint64_t row) {
+    switch (report.getColumnType(column)) {
+      case ColumnType::Counter:
+        OS << report.getValue(column, row);
+        break;
+      case ColumnType::Flag:
+        OS << (report.getValue(column, row) ? "true" : "false");
+        break;
+      case ColumnType::String: {
+        /* Same quoting as the CSV report of the pass */
+        StringRef cell = report.getStringCell(column, row);
+        if (cell.find_first_of(",\"") == StringRef::npos) {
+          OS << cell;
+          break;
+        }
+        OS << '"';
+        for (char c : cell) {
+          if (c == '"')
+            OS << '"';
+          OS << c;
+        }
+        OS << '"';
+        break;
+      }
+    }
+  }
+
+  int runTop() {
+    Report report;
+    if (!report.open(TopInput))
+      return 1;
+    std::optional<size_t> column = report.findNumericColumn(SortColumn);
+    if (!column)
+      return 1;
+
+    std::vector<uint64_t> rows(report.getRowCount());
+    std::iota(rows.begin(), rows.end(), 0);
+    auto isLarger = [&](uint64_t a, uint64_t b) {
+      uint64_t valueA = report.getValue(*column, a), valueB = report.getValue(*column, b);
+      return valueA != valueB ? valueA > valueB : a < b;
+    };
+    size_t count = std::min<size_t>(TopCount, rows.size());
+    std::partial_sort(rows.begin(), rows.begin() + count, rows.end(), isLarger);
+
+    for (size_t i = 0; i < count; ++i)
+      outs() << format_decimal(report.getValue(*column, rows[i]), 20) << "  " << report.getDemangledName(rows[i]) << "\n";
+    return 0;
+  }
+
+  int runFilter() {
+    std::vector<Condition> conditions;
+    for (const std::string &text : Conditions) {
+      std::optional<Condition> condition = parseCondition(text);
+      if (!condition)
+        return 1;
+      conditions.push_back(*condition);
+    }
+
+    bool isFirst = true;
+    for (const std::string &input : FilterInputs) {
+      Report report;
+      if (!report.open(input))
+        return 1;
+      std::vector<size_t> columns;
+      for (const Condition &condition : conditions) {
+        std::optional<size_t> column = report.findNumericColumn(condition.column);
+        if (!column)
+          return 1;
+        columns.push_back(*column);
+      }
+
+      /* The header comes from the first report; reports are expected to share their columns */
+      if (isFirst) {
+        ListSeparator separator(",");
+        for (size_t column = 0; column < report.getColumnCount(); ++column)
+          outs() << separator << '\'' << report.getColumnName(column) << '\'';
+        outs() << "\n";
+        isFirst = false;
+      }
+
+      for (uint64_t row = 0; row < report.getRowCount(); ++row) {
+        bool isMatch = true;
+        for (size_t i = 0; i < conditions.size() && isMatch; ++i)
+          isMatch = conditions[i].matches(report.getValue(columns[i], row));
+        if (isMatch && !NameFilter.empty())
+          isMatch = report.getDemangledName(row).contains(NameFilter) ||
+                    report.getMangledName(row).contains(NameFilter);
+        if (!isMatch)
+          continue;
+        ListSeparator separator(",");
+        for (size_t column = 0; column < report.getColumnCount(); ++column) {
+          outs() << separator;
+          printValue(outs(), report, column, row);
+        }
+        outs() << "\n";
+      }
+    }
+    return 0;
+  }
+
+  int runDiff() {
+    Report oldReport, newReport;
+    if (!oldReport.open(DiffOld) || !newReport.open(DiffNew))
+      return 1;
+    std::optional<size_t> oldColumn = oldReport.findNumericColumn(SortColumn);
+    std::optional<size_t> newColumn = newReport.findNumericColumn(SortColumn);
+    if (!oldColumn || !newColumn)
+      return 1;
+
+    struct Change {
+      StringRef name;
+      uint64_t oldValue = 0;
+      uint64_t newValue = 0;
+      bool inOld = false;
+      bool inNew = false;
+
+      uint64_t getMagnitude() const {
+        return newValue > oldValue ? newValue - oldValue : oldValue - newValue;
+      }
+    };
+    std::vector<Change> changes;
+    StringMap<size_t> byName;
+    for (uint64_t row = 0; row < oldReport.getRowCount(); ++row) {
+      auto inserted = byName.try_emplace(oldReport.getMangledName(row), changes.size());
+      if (!inserted.second)
+        continue;
+      changes.push_back({oldReport.getDemangledName(row), oldReport.getValue(*oldColumn, row), 0, true, false});
+    }
+    for (uint64_t row = 0; row < newReport.getRowCount(); ++row) {
+      auto inserted = byName.try_emplace(newReport.getMangledName(row), changes.size());
+      if (inserted.second)
+        changes.push_back({newReport.getDemangledName(row), 0, 0, false, false});
+      Change &change = changes[inserted.first->second];
+      if (change.inNew)
+        continue;
+      change.newValue = newReport.getValue(*newColumn, row);
+      change.inNew = true;
+    }
+
+    changes.erase(std::remove_if(changes.begin(), changes.end(),
+                                 [](const Change &change) { return change.inOld && change.inNew && !change.getMagnitude(); }),
+                  changes.end());
+    std::stable_sort(changes.begin(), changes.end(), [](const Change &a, const Change &b) {
+      return a.getMagnitude() > b.getMagnitude();
+    });
+    if (DiffCount && changes.size() > DiffCount)
+      changes.resize(DiffCount);
+
+    for (const Change &change : changes) {
+      outs() << (change.newValue >= change.oldValue ? '+' : '-') << change.getMagnitude() << "  "
+             << change.oldValue << " -> " << change.newValue << "  " << change.name;
+      if (!change.inOld)
+        outs() << " (added)";
+      else if (!change.inNew)
+        outs() << " (removed)";
+      outs() << "\n";
+    }
+    return 0;
+  }
+} /* end of anonymous namespace */
+
+int main(int argc, char **argv) {
+  InitLLVM X(argc, argv);
+  cl::ParseCommandLineOptions(argc, argv, "memcheck binary report query tool\n");
+
+  if (TopCommand)
+    return runTop();
+  if (FilterCommand)
+    return runFilter();
+  if (DiffCommand)
+    return runDiff();
+  errs() << "Error: expected a subcommand (top, filter or diff), see -help\n";
+  return 1;
+}
@@ -0,0 +1,166 @@
+/**
+ * @file memCheckReport.h
+ * @brief Helpers shared by the memcheck report tools for reading the CSV reports of the pass.
+ */
+#ifndef MEMCHECK_REPORT_H
+#define MEMCHECK_REPORT_H
+
+#include "llvm/ADT/SmallVector.h"
+#include "llvm/ADT/StringRef.h"
+#include "llvm/Support/Endian.h"
+
+#include <cstdint>
+#include <string>
+
+namespace memcheckReport {
+  /* Column of the mangled function name, the key every tool joins and deduplicates on */
+  constexpr unsigned mangledNameColumn = 1;
+
+  /**
+   * @brief Split a CSV row written by the pass into its raw fields.
+   *
+   * Fields keep their quotes, so the result points into the row and nothing is allocated. Use
+   * unquoteCSV to get the value of a quoted field.
+   *
+   * @param row The CSV row, without the line terminator.
+   * @param fields The raw fields of the row.
+   */
+  inline void splitCSVRow(llvm::StringRef row, llvm::SmallVectorImpl<llvm::StringRef> &fields) {
+    fields.clear();
+    size_t start = 0;
+    bool isQuoted = false;
+    for (size_t i = 0; i < row.size(); ++i) {
+      if (row[i] == '"')
+        isQuoted = !isQuoted;
+      else if (row[i] == ',' && !isQuoted) {
+        fields.push_back(row.slice(start, i));
+        start = i + 1;
+      }
+    }
+    fields.push_back(row.drop_front(start));
+  }
+
+  /**
+   * @brief Get the value of a raw CSV field, undoing the quoting of the pass's escapeCSV.
+   * @param field The raw field.
+   * @return The value of the field.
+   */
+  inline std::string unquoteCSV(llvm::StringRef field) {
+    if (field.size() < 2 || !field.startswith("\"") || !field.endswith("\""))
+      return field.str();
+    std::string value;
+    field = field.drop_front().drop_back();
+    for (size_t i = 0; i < field.size(); ++i) {
+      value += field[i];
+      if (field[i] == '"' && i + 1 < field.size() && field[i + 1] == '"')
+        ++i;
+    }
+    return value;
+  }
+
+  /**
+   * @brief Get the raw field of a row at a given column without splitting the whole row.
+   * @param row The CSV row.
+   * @param column The column index.
+   * @return The raw field, or an empty string if the row has fewer columns.
+   */
+  inline llvm::StringRef getCSVField(llvm::StringRef row, unsigned column) {
+    size_t start = 0;
+    bool isQuoted = false;
+    for (size_t i = 0; i < row.size(); ++i) {
+      if (row[i] == '"')
+        isQuoted = !isQuoted;
+      else if (row[i] == ',' && !isQuoted) {
+        if (column == 0)
+          return row.slice(start, i);
+        --column;
+        start = i + 1;
+      }
+    }
+    return column == 0 ? row.drop_front(start) : llvm::StringRef();
+  }
+
+  /**
+   * @brief Find a column of a report by name.
+   * @param header The header row, whose names are quoted with single quotes.
+   * @param name The column name, without quotes.
+   * @return The column index, or -1 if the report has no such column.
+   */
+  inline int findCSVColumn(llvm::StringRef header, llvm::StringRef name) {
+    llvm::SmallVector<llvm::StringRef, 32> fields;
+    splitCSVRow(header.rtrim(), fields);
+    for (size_t i = 0; i < fields.size(); ++i) {
+      llvm::StringRef field = fields[i].trim();
+      if (field.size() >= 2 && field.front() == '\'' && field.back() == '\'')
+        field = field.drop_front().drop_back();
+      if (field == name)
+        return int(i);
+    }
+    return -1;
+  }
+
+  /*
+   * Module summary (named metadata, see -memcheck-summary)
+   *
+   * The pass records every defined function of a module as one operand of the named metadata
+   * MEMCHECK_SUMMARY_METADATA, so the summary travels with the bitcode to the link step:
+   *
+   *   !{!"mangled name", i64 loads, i64 stores, i64 bytes, i64 isUserDefined, i64 isLocal,
+   *     !{!"callee", i64 weight, ...}}
+   *
+   * Metrics are the self metrics of the function, loop weighted if the pass ran with
+   * -memcheck-loops. isLocal is 1 for functions of local (static, internal or private) linkage,
+   * whose name is only unique within the module. The callee list holds every direct callee by
+   * mangled name, declarations included, with the weight of its call sites; a callee name
+   * refers to the local function of the same module if there is one. The version is part of the
+   * name; a change of layout gets a new name, so old tools just find no summary.
+   */
+#define MEMCHECK_SUMMARY_METADATA "memcheck.summary.v2"
+
+  /*
+   * Binary columnar report (.mcr)
+   *
+   * All integers are little-endian. The file starts with a BinaryHeader followed by one
+   * BinaryColumn per column. The data of every column starts on its own page (binaryPageSize)
+   * and holds one fixed-width cell per row: a 64-bit value for Counter and Flag columns, a 32-bit
+   * string table offset for String columns. The string table comes last and holds interned,
+   * NUL-terminated strings (column names and string cells).
+   */
+  constexpr char binaryMagic[8] = {'M', 'C', 'H', 'K', 'R', 'E', 'P', '1'};
+  constexpr uint32_t binaryVersion = 1;
+  constexpr uint64_t binaryPageSize = 4096;
+
+  enum class ColumnType : uint32_t {
+    Counter = 0,  /* uint64 */
+    String = 1,   /* uint32 string table offset */
+    Flag = 2,     /* uint64, 0 or 1 */
+  };
+
+  struct BinaryHeader {
+    char magic[8];
+    llvm::support::ulittle32_t version;
+    llvm::support::ulittle32_t columnCount;
+    llvm::support::ulittle64_t rowCount;
+    llvm::support::ulittle64_t stringTableOffset;
+    llvm::support::ulittle64_t stringTableSize;
+    llvm::support::ulittle64_t reserved[3] = {};
+  };
+  static_assert(sizeof(BinaryHeader) == 64, "BinaryHeader is part of the file format");
+
+  struct BinaryColumn {
+    llvm::support::ulittle32_t nameOffset;
+    llvm::support::ulittle32_t type;
+    llvm::support::ulittle64_t dataOffset;
+    llvm::support::ulittle64_t reserved = {};
+  };
+  static_assert(sizeof(BinaryColumn) == 24, "BinaryColumn is part of the file format");
+
+  /**
+   * @brief Get the width in bytes of a cell of a column type.
+   */
+  inline uint64_t getColumnWidth(ColumnType type) {
+    return type == ColumnType::String ? 4 : 8;
+  }
+} /* end of namespace memcheckReport */
+
+#endif /* MEMCHECK_REPORT_H */
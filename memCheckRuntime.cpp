@@ -0,0 +1,239 @@
+/**
+ * @file memCheckRuntime.cpp
+ * @brief Runtime library of the memcheck-instrument pass.
+ *
+ * Every thread gets its own counter array per module, so the instrumented code increments plain
+ * memory without atomics. Arrays are never freed: when a thread exits its arrays go back to a free
+ * list and are reused by later threads, so memory stays bounded by the peak number of threads.
+ * At exit the arrays of every module are summed and written, in the same CSV format as the static
+ * report plus a 'Calls' column, to $MEMCHECK_OUTPUT (default dynamic_function_analysis.csv; %p
+ * expands to the pid).
+ *
+ * The runtime only depends on libc and pthreads so that it links into C programs as well.
+ */
+#include "memCheckRuntime.h"
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+namespace {
+  /**
+   * @brief A growable array of counter arrays, valid when zero-initialized.
+   */
+  struct ArrayList {
+    uint64_t **items;
+    size_t count;
+    size_t capacity;
+
+    void push(uint64_t *item) {
+      if (count == capacity) {
+        capacity = capacity ? 2 * capacity : 8;
+        items = static_cast<uint64_t **>(realloc(items, capacity * sizeof(uint64_t *)));
+        if (!items) {
+          fputs("memcheck: out of memory\n", stderr);
+          abort();
+        }
+      }
+      items[count++] = item;
+    }
+  };
+
+  /**
+   * @brief Counter arrays of one instrumented module.
+   */
+  struct ModuleState {
+    const memcheckModule *module;
+    ArrayList arrays;      /* Every array handed out, summed at exit */
+    ArrayList freeArrays;  /* Arrays of exited threads, reused by new threads */
+    ModuleState *next;
+  };
+
+  /**
+   * @brief A counter array held by a thread, returned to its module at thread exit.
+   */
+  struct ThreadArray {
+    ModuleState *state;
+    uint64_t *counters;
+    ThreadArray *next;
+  };
+
+  /**
+   * @brief A function of the report, while rows of all modules are merged.
+   */
+  struct Row {
+    const char *mangledName;
+    const char *demangledName;
+    uint64_t counters[memcheckCounterCount];
+  };
+
+  pthread_mutex_t mutex = PTHREAD_MUTEX_INITIALIZER;
+  pthread_once_t initializeOnce = PTHREAD_ONCE_INIT;
+  pthread_key_t threadKey;
+  ModuleState *modules = nullptr;
+
+  void *allocate(size_t count, size_t size) {
+    void *memory = calloc(count ? count : 1, size);
+    if (!memory) {
+      fputs("memcheck: out of memory\n", stderr);
+      abort();
+    }
+    return memory;
+  }
+
+  /**
+   * @brief Return the arrays of an exiting thread to the free lists of their modules.
+   */
+  void releaseThreadArrays(void *list) {
+    pthread_mutex_lock(&mutex);
+    for (ThreadArray *array = static_cast<ThreadArray *>(list); array;) {
+      ThreadArray *next = array->next;
+      array->state->freeArrays.push(array->counters);
+      free(array);
+      array = next;
+    }
+    pthread_mutex_unlock(&mutex);
+  }
+
+  /**
+   * @brief Write a cell in CSV format, quoted like the static report.
+   */
+  void writeCSVCell(FILE *file, const char *cell) {
+    if (!strpbrk(cell, ",\"")) {
+      fputs(cell, file);
+      return;
+    }
+    fputc('"', file);
+    for (const char *c = cell; *c; ++c) {
+      if (*c == '"')
+        fputc('"', file);
+      fputc(*c, file);
+    }
+    fputc('"', file);
+  }
+
+  int compareRows(const void *a, const void *b) {
+    return strcmp(static_cast<const Row *>(a)->mangledName, static_cast<const Row *>(b)->mangledName);
+  }
+
+  /**
+   * @brief Sum the counters of every thread and write the dynamic report.
+   *
+   * Functions emitted by several modules (inline functions, templates) are merged by mangled name.
+   * Threads still running at exit are included as far as they got.
+   */
+  void writeReport() {
+    pthread_mutex_lock(&mutex);
+    size_t rowCount = 0;
+    for (ModuleState *state = modules; state; state = state->next)
+      rowCount += state->module->functionCount;
+    Row *rows = static_cast<Row *>(allocate(rowCount, sizeof(Row)));
+    size_t row = 0;
+    for (ModuleState *state = modules; state; state = state->next) {
+      const memcheckModule *module = state->module;
+      for (uint32_t function = 0; function < module->functionCount; ++function, ++row) {
+        rows[row].mangledName = module->functionNames[2 * function];
+        rows[row].demangledName = module->functionNames[2 * function + 1];
+        for (size_t array = 0; array < state->arrays.count; ++array) {
+          const uint64_t *counters = state->arrays.items[array] + function * memcheckCounterCount;
+          for (int counter = 0; counter < memcheckCounterCount; ++counter)
+            rows[row].counters[counter] += counters[counter];
+        }
+      }
+    }
+    pthread_mutex_unlock(&mutex);
+
+    /* Expand %p so that every process of a parallel job writes its own report */
+    const char *pattern = getenv("MEMCHECK_OUTPUT");
+    if (!pattern || !*pattern)
+      pattern = "dynamic_function_analysis.csv";
+    char fileName[4096];
+    size_t length = 0;
+    for (const char *c = pattern; *c && length + 32 < sizeof(fileName); ++c) {
+      if (c[0] == '%' && c[1] == 'p') {
+        length += snprintf(fileName + length, sizeof(fileName) - length, "%ld", long(getpid()));
+        ++c;
+      } else {
+        fileName[length++] = *c;
+      }
+    }
+    fileName[length] = '\0';
+
+    FILE *file = fopen(fileName, "w");
+    if (!file) {
+      fprintf(stderr, "Error: cannot open %s\n", fileName);
+      free(rows);
+      return;
+    }
+    fputs("'Function Name (Demangled)','Function Name (Mangled)','Loads','Stores','Bytes'"
+          ",'Memory Intrinsics','Memory Intrinsic Bytes','Unknown Length Memory Intrinsics'"
+          ",'Atomics','Atomic Bytes','Has Atomics','Masked Loads','Masked Stores','Masked Bytes','Calls' \n", file);
+
+    qsort(rows, rowCount, sizeof(Row), compareRows);
+    for (size_t first = 0; first < rowCount;) {
+      size_t last = first + 1;
+      for (; last < rowCount && !strcmp(rows[last].mangledName, rows[first].mangledName); ++last) {
+        for (int counter = 0; counter < memcheckCounterCount; ++counter)
+          rows[first].counters[counter] += rows[last].counters[counter];
+      }
+      const uint64_t *counters = rows[first].counters;
+      writeCSVCell(file, rows[first].demangledName);
+      fputc(',', file);
+      writeCSVCell(file, rows[first].mangledName);
+      /* Every length is known at run time, so there are no unknown length intrinsics */
+      fprintf(file, ",%llu,%llu,%llu,%llu,%llu,0,%llu,%llu,%s,%llu,%llu,%llu,%llu\n",
+              (unsigned long long)counters[memcheckLoads], (unsigned long long)counters[memcheckStores],
+              (unsigned long long)counters[memcheckBytes], (unsigned long long)counters[memcheckMemIntrinsics],
+              (unsigned long long)counters[memcheckMemIntrinsicBytes], (unsigned long long)counters[memcheckAtomics],
+              (unsigned long long)counters[memcheckAtomicBytes], counters[memcheckAtomics] ? "true" : "false",
+              (unsigned long long)counters[memcheckMaskedLoads], (unsigned long long)counters[memcheckMaskedStores],
+              (unsigned long long)counters[memcheckMaskedBytes], (unsigned long long)counters[memcheckCalls]);
+      first = last;
+    }
+    if (fclose(file))
+      fprintf(stderr, "Error: cannot write %s\n", fileName);
+    free(rows);
+  }
+
+  void initialize() {
+    pthread_key_create(&threadKey, releaseThreadArrays);
+    atexit(writeReport);
+  }
+} /* end of anonymous namespace */
+
+extern "C" uint64_t *__memcheck_thread_counters(const memcheckModule *module) {
+  pthread_once(&initializeOnce, initialize);
+  if (module->version != MEMCHECK_RUNTIME_VERSION) {
+    fprintf(stderr, "memcheck: module %s was instrumented for runtime version %u, expected %d\n",
+            module->moduleName, module->version, MEMCHECK_RUNTIME_VERSION);
+    abort();
+  }
+
+  pthread_mutex_lock(&mutex);
+  ModuleState *state = modules;
+  while (state && state->module != module)
+    state = state->next;
+  if (!state) {
+    state = static_cast<ModuleState *>(allocate(1, sizeof(ModuleState)));
+    state->module = module;
+    state->next = modules;
+    modules = state;
+  }
+  uint64_t *counters;
+  if (state->freeArrays.count) {
+    counters = state->freeArrays.items[--state->freeArrays.count];
+  } else {
+    counters = static_cast<uint64_t *>(allocate(size_t(module->functionCount) * memcheckCounterCount, sizeof(uint64_t)));
+    state->arrays.push(counters);
+  }
+  pthread_mutex_unlock(&mutex);
+
+  ThreadArray *array = static_cast<ThreadArray *>(allocate(1, sizeof(ThreadArray)));
+  array->state = state;
+  array->counters = counters;
+  array->next = static_cast<ThreadArray *>(pthread_getspecific(threadKey));
+  pthread_setspecific(threadKey, array);
+  return counters;
+}
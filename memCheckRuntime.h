@@ -0,0 +1,56 @@
+/**
+ * @file memCheckRuntime.h
+ * @brief Interface between the code inserted by the memcheck-instrument pass and the runtime library.
+ *
+ * The pass emits one memcheckModule descriptor per instrumented module and, at the entry of every
+ * instrumented function, fetches the counters of the current thread for that module. Each function
+ * owns memcheckCounterCount consecutive counters, indexed by memcheckCounter.
+ */
+#ifndef MEMCHECK_RUNTIME_H
+#define MEMCHECK_RUNTIME_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MEMCHECK_RUNTIME_VERSION 2
+
+/* Counters of an instrumented function, in the column order of the static report, then the calls */
+enum memcheckCounter {
+  memcheckLoads,
+  memcheckStores,
+  memcheckBytes,
+  memcheckMemIntrinsics,
+  memcheckMemIntrinsicBytes,
+  memcheckAtomics,
+  memcheckAtomicBytes,
+  memcheckMaskedLoads,
+  memcheckMaskedStores,
+  memcheckMaskedBytes,
+  memcheckCalls,
+  memcheckCounterCount
+};
+
+/* Descriptor of an instrumented module, emitted by the pass as a constant */
+struct memcheckModule {
+  uint32_t version;                   /* MEMCHECK_RUNTIME_VERSION */
+  uint32_t functionCount;             /* Number of instrumented functions */
+  const char *const *functionNames;   /* Mangled and demangled name of each function, interleaved */
+  const char *moduleName;             /* Module identifier */
+};
+
+/**
+ * @brief Get the counters of the calling thread for a module.
+ *
+ * Called once per thread and module; the instrumented code caches the result in a thread_local
+ * pointer. The array holds functionCount * memcheckCounterCount counters.
+ */
+uint64_t *__memcheck_thread_counters(const struct memcheckModule *module);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* MEMCHECK_RUNTIME_H */
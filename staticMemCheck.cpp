@@ -2,6 +2,9 @@
  * @file memcheck.cpp
  * @brief This file contains the memcheck class for analyzing LLVM functions.
  */
+#include "memCheckReport.h"
+#include "memCheckRuntime.h"
+
 #include "llvm/Pass.h"
 #include "llvm/IR/Function.h"
 #include "llvm/IR/Module.h"
@@ -9,217 +12,4104 @@
 #include "llvm/Support/raw_ostream.h"
 #include "llvm/Passes/PassBuilder.h"
 #include "llvm/Passes/PassPlugin.h"
+#include "llvm/ADT/DepthFirstIterator.h"
+#include "llvm/ADT/MapVector.h"
+#include "llvm/ADT/SCCIterator.h"
+#include "llvm/ADT/Statistic.h"
+#include "llvm/ADT/StringExtras.h"
+#include "llvm/Analysis/AliasAnalysis.h"
+#include "llvm/Analysis/BlockFrequencyInfo.h"
+#include "llvm/Analysis/CallGraph.h"
 #include "llvm/Analysis/LoopInfo.h"
+#include "llvm/Analysis/MemorySSA.h"
+#include "llvm/Analysis/OptimizationRemarkEmitter.h"
+#include "llvm/Analysis/ProfileSummaryInfo.h"
+#include "llvm/Analysis/ScalarEvolution.h"
+#include "llvm/Analysis/ScalarEvolutionExpressions.h"
+#include "llvm/Analysis/ValueTracking.h"
 #include <llvm/Demangle/Demangle.h>
 
 #include "llvm/IR/DebugInfo.h"
 #include "llvm/IR/DebugInfoMetadata.h"
+#include "llvm/IR/DiagnosticInfo.h"
+#include "llvm/IR/DiagnosticPrinter.h"
 #include "llvm/IR/DerivedTypes.h"
+#include "llvm/IR/Dominators.h"
+#include "llvm/IR/GetElementPtrTypeIterator.h"
+#include "llvm/IR/InstVisitor.h"
+#include "llvm/IR/InstIterator.h"
+#include "llvm/IR/IRBuilder.h"
 #include "llvm/IR/Instructions.h"
+#include "llvm/IR/IntrinsicInst.h"
+#include "llvm/IR/IntrinsicsAMDGPU.h"
+#include "llvm/IR/IntrinsicsNVPTX.h"
+#include "llvm/IR/MDBuilder.h"
+#include "llvm/IR/Operator.h"
+#include "llvm/IR/PassTimingInfo.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/Endian.h"
 #include "llvm/Support/FileSystem.h"
+#include "llvm/Support/JSON.h"
+#include "llvm/Support/LineIterator.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/GlobPattern.h"
+#include "llvm/Support/MathExtras.h"
+#include "llvm/Support/MemoryBuffer.h"
 #include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Support/ThreadPool.h"
+#include "llvm/Support/Threading.h"
+#include "llvm/Support/Timer.h"
+#include "llvm/Support/xxhash.h"
+#include "llvm/Transforms/Utils/BasicBlockUtils.h"
+
+#include <algorithm>
+#include <array>
+#include <limits>
+#include <map>
+#include <memory>
+#include <optional>
+#include <set>
+#include <string>
+#include <tuple>
+#include <cstdlib>
+#include <cstring>
+
+using namespace llvm;
+
+#define DEBUG_TYPE "memcheck"
+
+STATISTIC(NumFunctionsCounted, "Number of functions counted");
+STATISTIC(NumFunctionsCached, "Number of functions taken from the persistent cache");
+STATISTIC(NumFunctionsReported, "Number of functions reported");
+STATISTIC(NumAccessesCounted, "Number of loads and stores counted");
+STATISTIC(NumFunctionsInstrumented, "Number of functions instrumented by memcheck-instrument");
+
+/* Timers of the phases of the pass, shown with -time-passes */
+static constexpr StringLiteral timerGroupName = "memcheck";
+static constexpr StringLiteral timerGroupDescription = "memcheck pass phases";
+
+/* Command line options controlling the analysis modes */
+static cl::opt<bool> LoopWeighting(
+    "memcheck-loops",
+    cl::desc("Weight memory accesses by the trip counts of their enclosing loops"),
+    cl::init(false));
+
+static cl::opt<unsigned> DefaultTripCount(
+    "memcheck-default-trip-count",
+    cl::desc("Trip count assumed for loops whose trip count is not known (default = 100)"),
+    cl::init(100));
+
+static cl::opt<bool> ProfileWeighting(
+    "memcheck-profile",
+    cl::desc("Weight memory accesses by their basic block profile counts (requires PGO data)"),
+    cl::init(false));
+
+static cl::opt<bool> InclusiveMetrics(
+    "memcheck-inclusive",
+    cl::desc("Report inclusive (self + callees) metrics from a bottom-up call graph walk"),
+    cl::init(false));
+
+static cl::opt<bool> SummaryMetadata(
+    "memcheck-summary",
+    cl::desc("Record the self metrics and direct callees of every defined function in the module "
+             "(named metadata " MEMCHECK_SUMMARY_METADATA "), for the whole-program roll-up of memcheck-link"),
+    cl::init(false));
+
+static cl::opt<bool> StrideClassification(
+    "memcheck-strides",
+    cl::desc("Classify load and store bytes by the stride of their address in the innermost loop"),
+    cl::init(false));
+
+static cl::opt<bool> ObjectClassification(
+    "memcheck-objects",
+    cl::desc("Classify bytes by the underlying object of their address: stack, heap, global, argument or unknown"),
+    cl::init(false));
+
+static cl::opt<bool> VectorMetrics(
+    "memcheck-vectors",
+    cl::desc("Report vector accesses by vector width and the share of bytes moved by vector instructions"),
+    cl::init(false));
+
+static cl::opt<bool> GPUAnalysis(
+    "memcheck-gpu",
+    cl::desc("Flag GPU kernels and split bytes by NVPTX/AMDGPU address space; classify global accesses as "
+             "coalesced or uncoalesced by their stride along threadIdx.x (workitem.id.x)"),
+    cl::init(false));
+
+static cl::opt<bool> IntensityAnalysis(
+    "memcheck-intensity",
+    cl::desc("Report floating-point and integer operations and the arithmetic intensity (flops per byte) "
+             "of every function, and of every loop with -memcheck-footprint"),
+    cl::init(false));
+
+static cl::opt<std::string> MachineModelFile(
+    "memcheck-machine",
+    cl::desc("Machine description (JSON: peak_gflops and bandwidth_gbs per level L1, L2, LLC, DRAM) used by "
+             "-memcheck-intensity to place functions and loops on the roofline"),
+    cl::value_desc("filename"),
+    cl::init(""));
+
+static cl::opt<bool> RedundancyAnalysis(
+    "memcheck-redundancy",
+    cl::desc("Find redundant loads and dead stores with MemorySSA, per function and per source line "
+             "(static_redundancy_analysis.csv)"),
+    cl::init(false));
+
+static cl::opt<bool> AllocationReport(
+    "memcheck-allocations",
+    cl::desc("Write a report of heap allocation call sites weighted by their enclosing loops "
+             "(static_allocation_analysis.csv)"),
+    cl::init(false));
+
+static cl::opt<bool> OpenMPAnalysis(
+    "memcheck-openmp",
+    cl::desc("Attribute OpenMP parallel regions to their enclosing function, estimate per-thread bytes "
+             "and write false-sharing hints (static_false_sharing_analysis.csv)"),
+    cl::init(false));
+
+static cl::opt<unsigned> OpenMPThreads(
+    "memcheck-omp-threads",
+    cl::desc("Threads assumed for OpenMP parallel regions (default = 0, $OMP_NUM_THREADS or the hardware concurrency)"),
+    cl::init(0));
+
+static cl::opt<bool> FieldReport(
+    "memcheck-fields",
+    cl::desc("Write a per-struct-field access report with offsets, sizes and padding (static_field_analysis.csv)"),
+    cl::init(false));
+
+static cl::opt<bool> LineReport(
+    "memcheck-lines",
+    cl::desc("Write per-source-line access totals (static_line_analysis.csv) and their inlining stacks "
+             "in folded flame graph format (static_line_analysis.folded)"),
+    cl::init(false));
+
+static cl::opt<bool> FootprintReport(
+    "memcheck-footprint",
+    cl::desc("Write a per-loop working-set report (static_loop_analysis.csv)"),
+    cl::init(false));
+
+static cl::opt<unsigned> L1Size(
+    "memcheck-l1-size",
+    cl::desc("L1 data cache size in KiB used to flag loop footprints (default = 32)"),
+    cl::init(32));
+
+static cl::opt<unsigned> L2Size(
+    "memcheck-l2-size",
+    cl::desc("L2 cache size in KiB used to flag loop footprints (default = 1024)"),
+    cl::init(1024));
+
+static cl::opt<unsigned> LLCSize(
+    "memcheck-llc-size",
+    cl::desc("Last-level cache size in KiB used to flag loop footprints (default = 32768)"),
+    cl::init(32768));
+
+static cl::opt<unsigned> CacheLineSize(
+    "memcheck-cache-line-size",
+    cl::desc("Cache line size in bytes used to count loop footprints (default = 64)"),
+    cl::init(64));
+
+static cl::opt<unsigned> RecursionIterations(
+    "memcheck-recursion-iterations",
+    cl::desc("Fixed-point iterations used to estimate recursive call graph SCCs (default = 8)"),
+    cl::init(8));
+
+static cl::opt<unsigned> Threads(
+    "memcheck-threads",
+    cl::desc("Number of threads counting functions in parallel (default = 0, serial)"),
+    cl::init(0));
+
+static cl::opt<std::string> CacheDir(
+    "memcheck-cache-dir",
+    cl::desc("Directory of the persistent per-function analysis cache (default = no cache)"),
+    cl::init(""));
+
+static cl::opt<bool> RemarksOutput(
+    "memcheck-remarks",
+    cl::desc("Emit the function, loop (-memcheck-footprint) and line (-memcheck-lines) results as analysis "
+             "remarks of pass 'memcheck' instead of writing the report files, named with a PreOptimization "
+             "prefix in the pre-optimization run; see -pass-remarks-analysis and -fsave-optimization-record"),
+    cl::init(false));
+
+static cl::opt<unsigned> TopCount(
+    "memcheck-top",
+    cl::desc("Print a module summary to standard error: totals and percentiles of the summary metrics and "
+             "the top N functions by each of them (default = 0, no summary)"),
+    cl::init(0));
+
+static cl::list<std::string> TopMetrics(
+    "memcheck-top-by",
+    cl::desc("Counter columns of the module summary (default = Loads, Stores, Bytes and the loop and "
+             "profile weighted bytes when enabled)"),
+    cl::CommaSeparated);
+
+static cl::opt<std::string> BaselineReport(
+    "memcheck-baseline",
+    cl::desc("CSV report of a previous run; functions whose estimated bytes grew by more than "
+             "-memcheck-regression-threshold are diagnosed"),
+    cl::value_desc("filename"),
+    cl::init(""));
+
+static cl::opt<double> RegressionThreshold(
+    "memcheck-regression-threshold",
+    cl::desc("Growth in percent of the estimated bytes of a function over the baseline that is a regression "
+             "(default = 10)"),
+    cl::init(10.0));
+
+static cl::opt<unsigned> RegressionMinBytes(
+    "memcheck-regression-min-bytes",
+    cl::desc("Growth in bytes below which a function is never a regression, to ignore tiny functions (default = 0)"),
+    cl::init(0));
+
+static cl::opt<bool> RegressionErrors(
+    "memcheck-regression-error",
+    cl::desc("Fail the compilation (non-zero status) if any function regressed, instead of only warning"),
+    cl::init(false));
+
+static cl::opt<bool> Quiet(
+    "memcheck-quiet",
+    cl::desc("Do not print the per-function analysis to standard error"),
+    cl::init(false));
+
+static cl::opt<bool> BinaryReport(
+    "memcheck-binary",
+    cl::desc("Also write the report in the binary columnar format read by memcheck-query (.mcr)"),
+    cl::init(false));
+
+enum class PipelinePosition { None, Start, Last, Both };
+static cl::opt<PipelinePosition> PipelinePositions(
+    "memcheck-pipeline",
+    cl::desc("Where the plugin adds the pass to the default pipelines, e.g. with clang -fpass-plugin "
+             "(default = none); explicit -passes=memcheck pipelines are not affected"),
+    cl::init(PipelinePosition::None),
+    cl::values(clEnumValN(PipelinePosition::None, "none", "Only run the pass when named in -passes"),
+               clEnumValN(PipelinePosition::Start, "start", "Before optimization, reports tagged .pre"),
+               clEnumValN(PipelinePosition::Last, "last", "After optimization"),
+               clEnumValN(PipelinePosition::Both, "both", "Before and after optimization, plus the diff report")));
+
+static cl::list<std::string> UserRoots(
+    "memcheck-root",
+    cl::desc("Source root of user code; repeat or separate with commas for several roots "
+             "(default = $SCOP_ROOT, whose roots are separated like $PATH)"),
+    cl::CommaSeparated);
+
+static cl::list<std::string> IncludeGlobs(
+    "memcheck-include",
+    cl::desc("Only report source files under the roots that match one of these globs"),
+    cl::CommaSeparated);
+
+static cl::list<std::string> ExcludeGlobs(
+    "memcheck-exclude",
+    cl::desc("Never report source files that match one of these globs, e.g. '*/third_party/*'"),
+    cl::CommaSeparated);
+
+static cl::opt<std::string> OutputDir(
+    "memcheck-output-dir",
+    cl::desc("Directory for per-module reports named after the module "
+             "(default = static_function_analysis.* in the current directory)"),
+    cl::init(""));
+
+namespace {
+  class memcheckInstrument;
+
+  /**
+   * @brief Decides which source files are user code.
+   *
+   * A file is user code if it lies under one of the roots, matches one of the include globs (if
+   * any are given) and matches none of the exclude globs. The configuration is read once; roots
+   * are kept in a trie of path components, and decisions are cached per DIFile because all the
+   * functions of a header share one.
+   */
+  class UserCodeFilter {
+  public:
+    /**
+     * @brief Determines if a source file is user code.
+     * @param file The file of a DISubprogram.
+     */
+    bool isUserFile(const DIFile *file) {
+      if (!isConfigured)
+        configure();
+      auto decision = decisions.find(file);
+      if (decision != decisions.end())
+        return decision->second;
+
+      SmallString<256> path;
+      if (!sys::path::is_absolute(file->getFilename()))
+        path = file->getDirectory();
+      sys::path::append(path, file->getFilename());
+      sys::path::remove_dots(path, /*remove_dot_dot=*/true);
+      bool isUser = isUnderRoot(path) &&
+                    (includes.empty() || llvm::any_of(includes, [&](const GlobPattern &glob) { return glob.match(path); })) &&
+                    llvm::none_of(excludes, [&](const GlobPattern &glob) { return glob.match(path); });
+      decisions[file] = isUser;
+      return isUser;
+    }
+
+    /**
+     * @brief Forget the cached decisions, whose DIFiles belong to a single module.
+     */
+    void clearCache() { decisions.clear(); }
+
+  private:
+    /* A path component of the roots; node 0 is the empty path */
+    struct TrieNode {
+      StringMap<unsigned> children;
+      bool isRoot = false;
+    };
+    std::vector<TrieNode> trie;
+    std::vector<GlobPattern> includes;
+    std::vector<GlobPattern> excludes;
+    DenseMap<const DIFile *, bool> decisions;
+    bool isConfigured = false;
+
+    /**
+     * @brief Read the roots from -memcheck-root, else $SCOP_ROOT, and the globs.
+     */
+    void configure() {
+      isConfigured = true;
+      trie.assign(1, TrieNode());
+      SmallVector<StringRef, 4> roots(UserRoots.begin(), UserRoots.end());
+      const char *projectRoot = std::getenv("SCOP_ROOT");
+      if (roots.empty() && projectRoot)
+        StringRef(projectRoot).split(roots, sys::EnvPathSeparator, /*MaxSplit=*/-1, /*KeepEmpty=*/false);
+      if (roots.empty())
+        errs() << "Warning: no user code root, set $SCOP_ROOT or -memcheck-root; no function will be reported.\n";
+      for (StringRef root : roots)
+        addRoot(root);
+
+      auto addGlobs = [](const cl::list<std::string> &globs, std::vector<GlobPattern> &patterns) {
+        for (const std::string &glob : globs) {
+          Expected<GlobPattern> pattern = GlobPattern::create(glob);
+          if (pattern)
+            patterns.push_back(std::move(*pattern));
+          else
+            errs() << "Error: invalid glob '" << glob << "': " << toString(pattern.takeError()) << "\n";
+        }
+      };
+      addGlobs(IncludeGlobs, includes);
+      addGlobs(ExcludeGlobs, excludes);
+    }
+
+    void addRoot(StringRef root) {
+      SmallString<256> path(root);
+      sys::fs::make_absolute(path);
+      sys::path::remove_dots(path, /*remove_dot_dot=*/true);
+      unsigned node = 0;
+      for (auto component = sys::path::begin(path); component != sys::path::end(path); ++component) {
+        auto child = trie[node].children.try_emplace(*component, trie.size());
+        node = child.first->second;
+        /* Last, growing the trie invalidates the iterator */
+        if (child.second)
+          trie.emplace_back();
+      }
+      trie[node].isRoot = true;
+    }
+
+    bool isUnderRoot(StringRef path) const {
+      unsigned node = 0;
+      if (trie[node].isRoot)
+        return true;
+      for (auto component = sys::path::begin(path); component != sys::path::end(path); ++component) {
+        auto child = trie[node].children.find(*component);
+        if (child == trie[node].children.end())
+          return false;
+        node = child->second;
+        if (trie[node].isRoot)
+          return true;
+      }
+      return false;
+    }
+  };
+
+  /**
+   * @brief A diagnostic of the pass, reported through the diagnostic handler of the LLVMContext.
+   *
+   * Unlike errs(), the handler of clang counts errors, so an error fails the compilation.
+   */
+  class MemcheckDiagnostic : public DiagnosticInfo {
+  public:
+    MemcheckDiagnostic(const Twine &message, DiagnosticSeverity severity)
+        : DiagnosticInfo(getKindID(), severity), message(message) {}
+
+    void print(DiagnosticPrinter &DP) const override { DP << message; }
+
+    static bool classof(const DiagnosticInfo *DI) { return DI->getKind() == getKindID(); }
+
+  private:
+    const Twine &message;
+
+    static int getKindID() {
+      static const int kindID = getNextAvailablePluginDiagnosticKind();
+      return kindID;
+    }
+  };
+
+  /**
+   * @brief Pass for static function analysis.
+   */
+  class memcheck : public PassInfoMixin<memcheck> {
+  public:
+    /**
+     * @brief Position of a run in the pipeline, which decides the report names and the diff.
+     */
+    enum class Stage { Explicit, PreOptimization, PostOptimization };
+
+  private:
+    /* The instrumentation pass counts blocks with the same rules */
+    friend class memcheckInstrument;
+
+    /**
+     * @brief Arithmetic intensity of some code and where it lies on the roofline of the machine model.
+     */
+    struct RooflinePoint {
+      std::string intensity;      /* Flops per byte, "inf" without bytes, empty without either */
+      bool isMemoryBound = false; /* Whether the intensity is below the ridge point of the machine model */
+      std::string attainableGFlops; /* Roofline bound of the machine model, in GFLOP/s */
+      uint64_t memoryExcessTime = 0; /* Time in ps by which moving the bytes exceeds computing the flops */
+    };
+
+    /**
+     * @brief Sets of metrics gated by the options of a run (see memCheckMetrics.def).
+     */
+    enum class MetricGroup {
+#define METRIC_GROUP(group, isEnabled, isCacheKey) group,
+#include "memCheckMetrics.def"
+    };
+
+    /**
+     * @brief Struct to store analysis results for a function.
+     *
+     * The counters are declared by memCheckMetrics.def, which also makes them cache fields and
+     * report columns; only the other results are declared here.
+     */
+    struct FunctionAnalysis {
+      std::string mangledName;    /* Mangled function name */
+      std::string demangledName;  /* Demangled function name */
+      std::string dynBytesExpr;   /* Dynamic bytes as an expression, if any trip count is symbolic */
+      bool isHot = false;         /* Whether the profile summary considers the function hot */
+      std::string parallelParent; /* Enclosing source function of an outlined parallel region, if any */
+      RooflinePoint roofline;     /* Flops of the most precise model on the roofline, with -memcheck-intensity */
+      bool isGPUKernel = false;   /* Whether the function is a GPU kernel entry point */
+#define COUNTER(field, column, group) uint64_t field = 0;
+#define UNCACHED_COUNTER(field, column, group) uint64_t field = 0;
+#include "memCheckMetrics.def"
+    };
+
+    /**
+     * @brief Reported functions of the pre-optimization run of a module, diffed by the post-optimization run.
+     */
+    struct OptimizationSnapshot {
+      std::string moduleIdentifier;
+      std::vector<FunctionAnalysis> functions;
+    };
+
+    /**
+     * @brief Static totals of a group of accesses, e.g. a basic block or a loop.
+     */
+    struct AccessTotals {
+      size_t loads = 0;
+      size_t stores = 0;
+      size_t bytes = 0;
+      size_t flops = 0;
+      size_t intOps = 0;
+
+      void add(const AccessTotals &other) {
+        loads += other.loads;
+        stores += other.stores;
+        bytes += other.bytes;
+        flops += other.flops;
+        intOps += other.intOps;
+      }
+    };
+
+    /**
+     * @brief Peak compute and bandwidths of the machine model (see -memcheck-machine).
+     */
+    struct MachineModel {
+      double peakGFlops = 0;  /* Peak floating-point operations, in GFLOP/s */
+      double l1Bandwidth = 0; /* Bandwidths per level, in GB/s; a missing level takes the next outer one */
+      double l2Bandwidth = 0;
+      double llcBandwidth = 0;
+      double dramBandwidth = 0;
+    };
+
+    /**
+     * @brief A load or store whose address is classified by finishFunction (see classifyStride).
+     */
+    struct PointerAccess {
+      Instruction *I;
+      Value *pointer;   /* Accessed address, nullptr for a vector of addresses (gather/scatter) */
+      uint64_t bytes;   /* Bytes accessed */
+    };
+
+    /**
+     * @brief Stride classes of an accessed address (see classifyStride).
+     */
+    enum class StrideClass { Invariant, UnitStride, Strided, Indirect };
+
+    /**
+     * @brief Classes of the underlying object of an accessed address (see classifyObject).
+     */
+    enum class ObjectClass { Stack, Heap, Global, Argument, Unknown };
+
+    /**
+     * @brief Static counts of a function before any weighting.
+     *
+     * Counting only reads the IR, so it can run on many functions in parallel. Everything that
+     * needs function analyses (ScalarEvolution, LoopInfo, BlockFrequencyInfo) is deferred to
+     * finishFunction, which runs serially.
+     */
+    struct CountedFunction {
+      FunctionAnalysis analysis;
+      SmallVector<AccessTotals, 8> blockTotals; /* Per basic block, in function order */
+      SmallVector<std::pair<unsigned, AnyMemIntrinsic *>, 0> deferredIntrinsics; /* Block index and intrinsic of non-constant length */
+      SmallVector<PointerAccess, 0> accesses; /* Loads and stores to classify, with -memcheck-strides */
+      uint64_t cacheKey = 0;     /* Key of the function in the persistent cache */
+      bool isCached = false;     /* Whether the analysis was taken from the cache */
+    };
+
+    /**
+     * @brief Trip count of a single loop, as far as ScalarEvolution can tell.
+     */
+    struct TripCount {
+      uint64_t estimate = 1;            /* Numeric trip count used for the dynamic estimates */
+      const SCEV *symbolic = nullptr;   /* Trip count expression, if it is not a constant */
+    };
+
+    /**
+     * @brief An outlined OpenMP parallel region (or task) body, found at its fork call.
+     */
+    struct ParallelRegion {
+      Function *parent;          /* Function forking the region */
+      bool hasThreadIdArgument;  /* libomp bodies get a pointer to the global thread id first */
+    };
+
+    /**
+     * @brief A store of a parallel region that may falsely share a cache line with other threads.
+     */
+    struct FalseSharingHint {
+      StoreInst *store;
+      StringRef pattern;   /* "thread-indexed" or "adjacent fields" */
+      uint64_t distance;   /* Bytes between the locations of different threads (or fields) */
+    };
+
+    /* Outlined parallel regions of the module being analyzed, with -memcheck-openmp (see findParallelRegions) */
+    DenseMap<const Function *, ParallelRegion> parallelRegions;
+
+    /* Kernels listed in the nvvm.annotations of the module being analyzed, with -memcheck-gpu */
+    DenseSet<const Function *> annotatedKernels;
+
+    /* Position in the pipeline, and the snapshot shared by the runs of both ends of it */
+    Stage stage = Stage::Explicit;
+    std::shared_ptr<OptimizationSnapshot> snapshot;
+
+    /* Filter of the functions to report, configured on first use */
+    UserCodeFilter userCodeFilter;
+
+    /* Report of -memcheck-baseline, read on first use, and its rows by mangled name */
+    std::unique_ptr<MemoryBuffer> baselineBuffer;
+    StringRef baselineHeader;
+    StringMap<StringRef> baselineRows;
+    bool isBaselineLoaded = false;
+
+    /* Profile summary of the module being analyzed, if it has profile data and -memcheck-profile is on */
+    ProfileSummaryInfo *PSI = nullptr;
+
+    /* Machine model of -memcheck-machine, read at the start of every run */
+    std::optional<MachineModel> machineModel;
+
+    /* Persistent cache of the module being analyzed (see loadCache) */
+    static constexpr StringLiteral cacheRecordVersion = "v5";
+    std::string cacheFileName;
+    DenseMap<uint64_t, FunctionAnalysis> cache;
+    size_t cacheFileRecords = 0;
+
+    // Output files names (see setOutputFileNames)
+    std::string csvFileName = "static_function_analysis.csv";
+    std::string jsonFileName = "static_function_analysis.json";
+    std::string binaryFileName = "static_function_analysis.mcr";
+    std::string loopsFileName = "static_loop_analysis.csv";
+    std::string redundancyFileName = "static_redundancy_analysis.csv";
+    std::string allocationsFileName = "static_allocation_analysis.csv";
+    std::string falseSharingFileName = "static_false_sharing_analysis.csv";
+    std::string fieldsFileName = "static_field_analysis.csv";
+    std::string linesFileName = "static_line_analysis.csv";
+    std::string foldedFileName = "static_line_analysis.folded";
+    std::string diffFileName = "static_optimization_diff.csv";
+
+    /**
+     * @brief Choose the output file names of a module.
+     *
+     * Without -memcheck-output-dir every module writes static_function_analysis.* in the current
+     * directory. Otherwise each module gets its own files in that directory, named after the
+     * source file plus a hash of the module identifier, so that translation units with the same
+     * file name in different directories do not collide and parallel compiles never share a file.
+     * The reports of a pre-optimization run are tagged .pre, e.g. static_function_analysis.pre.csv.
+     *
+     * @param M The LLVM module being analyzed.
+     * @return false if the output directory cannot be created.
+     */
+    bool setOutputFileNames(const Module &M) {
+      if (OutputDir.empty()) {
+        csvFileName = "static_function_analysis.csv";
+        jsonFileName = "static_function_analysis.json";
+        binaryFileName = "static_function_analysis.mcr";
+        loopsFileName = "static_loop_analysis.csv";
+        redundancyFileName = "static_redundancy_analysis.csv";
+        allocationsFileName = "static_allocation_analysis.csv";
+        falseSharingFileName = "static_false_sharing_analysis.csv";
+        fieldsFileName = "static_field_analysis.csv";
+        linesFileName = "static_line_analysis.csv";
+        foldedFileName = "static_line_analysis.folded";
+        diffFileName = "static_optimization_diff.csv";
+        addStageSuffix();
+        return true;
+      }
+
+      if (std::error_code EC = sys::fs::create_directories(OutputDir)) {
+        errs() << "Error: cannot create the output directory " << OutputDir << ": " << EC.message() << "\n";
+        return false;
+      }
+
+      StringRef source = M.getSourceFileName().empty() ? StringRef(M.getModuleIdentifier())
+                                                       : StringRef(M.getSourceFileName());
+      std::string stem = sys::path::filename(source).str();
+      for (char &c : stem) {
+        if (!isAlnum(c) && c != '.' && c != '_' && c != '-')
+          c = '_';
+      }
+      if (stem.empty())
+        stem = "module";
+      raw_string_ostream(stem) << '.' << format_hex_no_prefix(xxHash64(M.getModuleIdentifier()) & 0xffffffff, 8);
+
+      SmallString<256> path(OutputDir);
+      sys::path::append(path, stem + ".csv");
+      csvFileName = std::string(path.str());
+      sys::path::replace_extension(path, "json");
+      jsonFileName = std::string(path.str());
+      sys::path::replace_extension(path, "mcr");
+      binaryFileName = std::string(path.str());
+      sys::path::replace_extension(path, "loops.csv");
+      loopsFileName = std::string(path.str());
+      path = OutputDir;
+      sys::path::append(path, stem + ".redundancy.csv");
+      redundancyFileName = std::string(path.str());
+      path = OutputDir;
+      sys::path::append(path, stem + ".allocations.csv");
+      allocationsFileName = std::string(path.str());
+      path = OutputDir;
+      sys::path::append(path, stem + ".false_sharing.csv");
+      falseSharingFileName = std::string(path.str());
+      path = OutputDir;
+      sys::path::append(path, stem + ".fields.csv");
+      fieldsFileName = std::string(path.str());
+      path = OutputDir;
+      sys::path::append(path, stem + ".lines.csv");
+      linesFileName = std::string(path.str());
+      sys::path::replace_extension(path, "folded");
+      foldedFileName = std::string(path.str());
+      path = OutputDir;
+      sys::path::append(path, stem + ".optimization_diff.csv");
+      diffFileName = std::string(path.str());
+      addStageSuffix();
+      return true;
+    }
+
+    /**
+     * @brief Tag the report names of a pre-optimization run, so that the post-optimization run keeps the usual names.
+     */
+    void addStageSuffix() {
+      if (stage != Stage::PreOptimization)
+        return;
+      for (std::string *fileName : {&csvFileName, &jsonFileName, &binaryFileName, &loopsFileName, &redundancyFileName,
+                                    &allocationsFileName, &falseSharingFileName, &fieldsFileName, &linesFileName,
+                                    &foldedFileName}) {
+        SmallString<256> path(*fileName);
+        sys::path::replace_extension(path, ".pre" + sys::path::extension(*fileName));
+        *fileName = std::string(path.str());
+      }
+    }
+
+    /**
+     * @brief Compute the trip count of a loop.
+     *
+     * Constant trip counts are used as is. Otherwise the backedge-taken count is turned into a
+     * symbolic trip count, provided it does not vary with an enclosing loop, and the numeric
+     * estimate falls back to the constant maximum trip count or to -memcheck-default-trip-count.
+     *
+     * @param L The loop.
+     * @param SE The ScalarEvolution analysis of the enclosing function.
+     * @return The trip count of the loop.
+     */
+    TripCount getTripCount(const Loop *L, ScalarEvolution &SE) {
+      TripCount tripCount;
+      if (unsigned constant = SE.getSmallConstantTripCount(L)) {
+        tripCount.estimate = constant;
+        return tripCount;
+      }
+
+      const Loop *outermost = L;
+      while (outermost->getParentLoop())
+        outermost = outermost->getParentLoop();
+
+      const SCEV *backedgeTaken = SE.getBackedgeTakenCount(L);
+      if (!isa<SCEVCouldNotCompute>(backedgeTaken) && SE.isLoopInvariant(backedgeTaken, outermost)) {
+        Type *int64Ty = Type::getInt64Ty(L->getHeader()->getContext());
+        tripCount.symbolic = SE.getAddExpr(SE.getTruncateOrZeroExtend(backedgeTaken, int64Ty),
+                                           SE.getOne(int64Ty));
+      }
+
+      unsigned maxTripCount = SE.getSmallConstantMaxTripCount(L);
+      tripCount.estimate = maxTripCount ? maxTripCount : DefaultTripCount.getValue();
+      return tripCount;
+    }
+
+    /**
+     * @brief Compute the numeric weight of a loop nest, i.e. the product of its trip counts.
+     * @param L The innermost loop of the nest, or nullptr for code outside of loops.
+     * @param SE The ScalarEvolution analysis of the enclosing function.
+     * @return The estimated number of executions of the loop body per function invocation.
+     */
+    uint64_t getLoopNestWeight(const Loop *L, ScalarEvolution &SE) {
+      uint64_t weight = 1;
+      for (; L; L = L->getParentLoop())
+        weight = SaturatingMultiply(weight, getTripCount(L, SE).estimate);
+      return weight;
+    }
+
+    /**
+     * @brief Compute the dynamic loads, stores, bytes and operations of a function from its per-loop totals.
+     * @param F The LLVM function being analyzed.
+     * @param loopTotals Static totals keyed by innermost loop (nullptr for code outside of loops).
+     * @param SE The ScalarEvolution analysis of the function.
+     * @param result The analysis results to fill in.
+     */
+    void computeDynamicCounts(Function &F, const DenseMap<const Loop *, AccessTotals> &loopTotals,
+                              ScalarEvolution &SE, FunctionAnalysis &result) {
+      Type *int64Ty = Type::getInt64Ty(F.getContext());
+      bool isSymbolic = false;
+      SmallVector<const SCEV *, 8> byteTerms;
+
+      for (const auto &entry : loopTotals) {
+        /* Multiply the trip counts of the whole loop nest */
+        uint64_t weight = 1;
+        const SCEV *symbolicWeight = SE.getOne(int64Ty);
+        for (const Loop *L = entry.first; L; L = L->getParentLoop()) {
+          TripCount tripCount = getTripCount(L, SE);
+          weight = SaturatingMultiply(weight, tripCount.estimate);
+          if (tripCount.symbolic) {
+            isSymbolic = true;
+            symbolicWeight = SE.getMulExpr(symbolicWeight, tripCount.symbolic);
+          } else {
+            symbolicWeight = SE.getMulExpr(symbolicWeight, SE.getConstant(int64Ty, tripCount.estimate));
+          }
+        }
+
+        const AccessTotals &totals = entry.second;
+        result.dynLoads = SaturatingAdd(result.dynLoads, SaturatingMultiply<uint64_t>(totals.loads, weight));
+        result.dynStores = SaturatingAdd(result.dynStores, SaturatingMultiply<uint64_t>(totals.stores, weight));
+        result.dynBytes = SaturatingAdd(result.dynBytes, SaturatingMultiply<uint64_t>(totals.bytes, weight));
+        result.dynFlops = SaturatingAdd(result.dynFlops, SaturatingMultiply<uint64_t>(totals.flops, weight));
+        result.dynIntOps = SaturatingAdd(result.dynIntOps, SaturatingMultiply<uint64_t>(totals.intOps, weight));
+        byteTerms.push_back(SE.getMulExpr(SE.getConstant(int64Ty, totals.bytes), symbolicWeight));
+      }
+
+      /* Only keep an expression if it says more than the numeric estimate */
+      if (isSymbolic) {
+        raw_string_ostream exprStream(result.dynBytesExpr);
+        SE.getAddExpr(byteTerms)->print(exprStream);
+      }
+    }
+
+    /**
+     * @brief Get the bytes of a load or store of a type, of every kind (plain, masked, atomic).
+     *
+     * All accesses count the allocation size of their type, padding included, like an array
+     * element: a <3 x float> access counts 16 bytes whether it is masked or not.
+     */
+    static uint64_t getTypeAccessBytes(const DataLayout &DL, Type *T) {
+      return DL.getTypeAllocSize(T).getKnownMinValue();
+    }
+
+    /**
+     * @brief Compute the bytes moved by a memory intrinsic of known length.
+     *
+     * memcpy and memmove read and write their length, memset only writes it.
+     *
+     * @param memIntrinsic The memory intrinsic.
+     * @param length The length in bytes.
+     * @return The bytes read and written.
+     */
+    static uint64_t getMemIntrinsicBytes(const AnyMemIntrinsic *memIntrinsic, uint64_t length) {
+      return isa<AnyMemTransferInst>(memIntrinsic) ? SaturatingMultiply<uint64_t>(length, 2) : length;
+    }
+
+    /**
+     * @brief Count a load or store in the vector categories if it accesses a vector type.
+     * @param T The accessed type.
+     * @param bytes The bytes accessed.
+     * @param isLoad Whether the access is a load.
+     * @param result The analysis results whose vector categories are updated.
+     */
+    static void countVectorAccess(Type *T, uint64_t bytes, bool isLoad, FunctionAnalysis &result) {
+      if (!isa<VectorType>(T))
+        return;
+      (isLoad ? result.vectorLoads : result.vectorStores)++;
+      result.vectorBytes += bytes;
+      if (isa<ScalableVectorType>(T))
+        result.scalableVectorBytes += bytes;
+      else if (bytes <= 16)
+        result.vector128Bytes += bytes;
+      else if (bytes <= 32)
+        result.vector256Bytes += bytes;
+      else
+        result.vector512Bytes += bytes;
+    }
+
+    /**
+     * @brief Get the number of lanes of a type, 1 for scalars and the known minimum for scalable vectors.
+     */
+    static uint64_t getLaneCount(Type *T) {
+      if (auto *vectorTy = dyn_cast<VectorType>(T))
+        return vectorTy->getElementCount().getKnownMinValue();
+      return 1;
+    }
+
+    /**
+     * @brief Counts the memory traffic and the operations of instructions, in one visit per instruction.
+     *
+     * Plain loads and stores count as such. Memory intrinsics, atomics and masked vector accesses
+     * are counted in their own categories; their bytes are also added to the total. Atomics both
+     * read and write their operand. Memory intrinsics whose length is not a constant are left to
+     * finishFunction. Every access counts the allocation size of its type (see getTypeAccessBytes);
+     * scalable vectors count their known minimum size, i.e. assume vscale = 1.
+     *
+     * The metrics of the optional groups of memCheckMetrics.def are only counted when their group
+     * is enabled: vector accesses by width (countVectorAccess, Vectors) and arithmetic operations,
+     * one per vector lane and two for a fused multiply-add (countOperation, Intensity). A new
+     * metric is a counter in memCheckMetrics.def, which declares its field, cache slot and column,
+     * plus its update here: a new kind of instruction gets a visit method, a new intrinsic a case
+     * of visitIntrinsicInst; everything else falls through to visitInstruction and counts nothing.
+     */
+    class InstructionCounter : public InstVisitor<InstructionCounter, AccessTotals> {
+    public:
+      /**
+       * @param pass The pass, whose enabled metric groups are counted.
+       * @param DL The DataLayout of the module.
+       * @param result The analysis results whose categories are updated.
+       */
+      InstructionCounter(const memcheck &pass, const DataLayout &DL, FunctionAnalysis &result)
+          : DL(DL), result(result), countsVectors(pass.isMetricGroupEnabled(MetricGroup::Vectors)),
+            countsOperations(pass.isMetricGroupEnabled(MetricGroup::Intensity)) {}
+
+      bool isDeferred = false;  /* Set by a memory intrinsic whose length needs ScalarEvolution */
+
+      AccessTotals visitInstruction(Instruction &) { return {}; }
+
+      AccessTotals visitBinaryOperator(BinaryOperator &I) { return countOperation(I); }
+
+      AccessTotals visitUnaryOperator(UnaryOperator &I) { return countOperation(I); }
+
+      AccessTotals visitLoadInst(LoadInst &load) {
+        AccessTotals counts;
+        counts.loads = 1;
+        counts.bytes = getTypeAccessBytes(DL, load.getType());
+        if (countsVectors)
+          countVectorAccess(load.getType(), counts.bytes, /*isLoad=*/true, result);
+        return counts;
+      }
+
+      AccessTotals visitStoreInst(StoreInst &store) {
+        AccessTotals counts;
+        counts.stores = 1;
+        counts.bytes = getTypeAccessBytes(DL, store.getValueOperand()->getType());
+        if (countsVectors)
+          countVectorAccess(store.getValueOperand()->getType(), counts.bytes, /*isLoad=*/false, result);
+        return counts;
+      }
+
+      AccessTotals visitAtomicRMWInst(AtomicRMWInst &rmw) {
+        return countAtomic(rmw.getValOperand()->getType());
+      }
+
+      AccessTotals visitAtomicCmpXchgInst(AtomicCmpXchgInst &cmpxchg) {
+        return countAtomic(cmpxchg.getNewValOperand()->getType());
+      }
+
+      /* Memory intrinsics (their atomic variants included), masked vector accesses and arithmetic intrinsics */
+      AccessTotals visitIntrinsicInst(IntrinsicInst &intrinsic) {
+        AccessTotals counts;
+        if (auto *memIntrinsic = dyn_cast<AnyMemIntrinsic>(&intrinsic)) {
+          result.memIntrinsics++;
+          if (auto *length = dyn_cast<ConstantInt>(memIntrinsic->getLength())) {
+            counts.bytes = getMemIntrinsicBytes(memIntrinsic, length->getLimitedValue());
+            result.memIntrinsicBytes += counts.bytes;
+          } else {
+            isDeferred = true;
+          }
+          return counts;
+        }
+        switch (intrinsic.getIntrinsicID()) {
+          case Intrinsic::masked_load:
+          case Intrinsic::masked_gather:
+            result.maskedLoads++;
+            counts.bytes = getTypeAccessBytes(DL, intrinsic.getType());
+            result.maskedBytes += counts.bytes;
+            if (countsVectors)
+              countVectorAccess(intrinsic.getType(), counts.bytes, /*isLoad=*/true, result);
+            break;
+          case Intrinsic::masked_store:
+          case Intrinsic::masked_scatter:
+            result.maskedStores++;
+            counts.bytes = getTypeAccessBytes(DL, intrinsic.getArgOperand(0)->getType());
+            result.maskedBytes += counts.bytes;
+            if (countsVectors)
+              countVectorAccess(intrinsic.getArgOperand(0)->getType(), counts.bytes, /*isLoad=*/false, result);
+            break;
+          case Intrinsic::fma:
+          case Intrinsic::fmuladd:
+            if (countsOperations)
+              counts.flops = 2 * getLaneCount(intrinsic.getType());
+            break;
+          /* A reduction of n lanes takes n - 1 operations, plus one with its start value */
+          case Intrinsic::vector_reduce_fadd:
+          case Intrinsic::vector_reduce_fmul:
+            if (countsOperations)
+              counts.flops = getLaneCount(intrinsic.getArgOperand(1)->getType());
+            break;
+          default:
+            break;
+        }
+        return counts;
+      }
+
+    private:
+      const DataLayout &DL;
+      FunctionAnalysis &result;
+      bool countsVectors;     /* MetricGroup::Vectors */
+      bool countsOperations;  /* MetricGroup::Intensity */
+
+      AccessTotals countOperation(Instruction &I) const {
+        AccessTotals counts;
+        if (countsOperations)
+          (I.getType()->isFPOrFPVectorTy() ? counts.flops : counts.intOps) = getLaneCount(I.getType());
+        return counts;
+      }
+
+      AccessTotals countAtomic(Type *T) {
+        AccessTotals counts;
+        result.atomics++;
+        counts.bytes = 2 * getTypeAccessBytes(DL, T);
+        result.atomicBytes += counts.bytes;
+        return counts;
+      }
+    };
+
+    /**
+     * @brief Count the memory traffic and the operations of a single instruction (see InstructionCounter).
+     * @param I The instruction.
+     * @param DL The DataLayout of the module.
+     * @param result The analysis results whose categories are updated.
+     * @param isDeferred Set if the instruction is a memory intrinsic whose length needs ScalarEvolution.
+     * @return The loads, stores, bytes and operations contributed to the totals.
+     */
+    AccessTotals countInstruction(Instruction &I, const DataLayout &DL, FunctionAnalysis &result,
+                                  bool &isDeferred) const {
+      InstructionCounter counter(*this, DL, result);
+      AccessTotals counts = counter.visit(I);
+      isDeferred |= counter.isDeferred;
+      return counts;
+    }
+
+    /**
+     * @brief Get the address of a load, store or masked vector access.
+     * @param I The instruction.
+     * @param pointer Set to the accessed address, or to nullptr for gathers and scatters.
+     * @return Whether the instruction is such an access.
+     */
+    static bool getAccessPointer(Instruction &I, Value *&pointer) {
+      if (Value *operand = getLoadStorePointerOperand(&I)) {
+        pointer = operand;
+        return true;
+      }
+      if (auto *intrinsic = dyn_cast<IntrinsicInst>(&I)) {
+        switch (intrinsic->getIntrinsicID()) {
+          case Intrinsic::masked_load:
+            pointer = intrinsic->getArgOperand(0);
+            return true;
+          case Intrinsic::masked_store:
+            pointer = intrinsic->getArgOperand(1);
+            return true;
+          case Intrinsic::masked_gather:
+          case Intrinsic::masked_scatter:
+            pointer = nullptr;
+            return true;
+          default:
+            break;
+        }
+      }
+      return false;
+    }
+
+    /**
+     * @brief Determines if a function allocates heap memory and returns it.
+     *
+     * Covers the C allocation functions and every variant of operator new and new[]. Matching by
+     * name rather than with TargetLibraryInfo keeps this usable from the counting threads.
+     *
+     * @param name The mangled function name.
+     */
+    static bool isHeapAllocationFunction(StringRef name) {
+      return name == "malloc" || name == "calloc" || name == "realloc" || name == "aligned_alloc" ||
+             name == "memalign" || name == "valloc" || name == "pvalloc" || name == "reallocarray" ||
+             name.startswith("_Znw") || name.startswith("_Zna");
+    }
+
+    /**
+     * @brief Classify an address by its underlying object.
+     *
+     * The address is followed through GEPs, casts and simple selects/phis as far as
+     * getUnderlyingObject goes; anything loaded from memory or returned by a call other than a heap
+     * allocation is unknown.
+     *
+     * @param pointer The address, or nullptr for a vector of addresses.
+     * @return The class of the underlying object.
+     */
+    static ObjectClass classifyObject(const Value *pointer) {
+      if (!pointer)
+        return ObjectClass::Unknown;
+      const Value *object = getUnderlyingObject(pointer);
+      if (isa<AllocaInst>(object))
+        return ObjectClass::Stack;
+      if (isa<GlobalVariable>(object))
+        return ObjectClass::Global;
+      if (isa<Argument>(object))
+        return ObjectClass::Argument;
+      if (auto *call = dyn_cast<CallBase>(object)) {
+        if (Function *callee = call->getCalledFunction())
+          if (isHeapAllocationFunction(callee->getName()))
+            return ObjectClass::Heap;
+      }
+      return ObjectClass::Unknown;
+    }
+
+    /**
+     * @brief Add bytes to the category of the underlying object of an address.
+     */
+    static void countObjectBytes(const Value *pointer, uint64_t bytes, FunctionAnalysis &result) {
+      switch (classifyObject(pointer)) {
+        case ObjectClass::Stack: result.stackBytes += bytes; break;
+        case ObjectClass::Heap: result.heapBytes += bytes; break;
+        case ObjectClass::Global: result.globalBytes += bytes; break;
+        case ObjectClass::Argument: result.argumentBytes += bytes; break;
+        case ObjectClass::Unknown: result.unknownObjectBytes += bytes; break;
+      }
+    }
+
+    /**
+     * @brief Attribute the bytes of an instruction to the underlying objects of its addresses.
+     *
+     * Memory transfers split their bytes evenly between the source and the destination, so that
+     * the object classes always add up to the total bytes.
+     *
+     * @param I The instruction.
+     * @param bytes The bytes counted for the instruction.
+     * @param result The analysis results whose object categories are updated.
+     */
+    static void countInstructionObjects(Instruction &I, uint64_t bytes, FunctionAnalysis &result) {
+      if (!bytes)
+        return;
+      Value *pointer = nullptr;
+      if (auto *transfer = dyn_cast<AnyMemTransferInst>(&I)) {
+        countObjectBytes(transfer->getRawSource(), bytes / 2, result);
+        countObjectBytes(transfer->getRawDest(), bytes - bytes / 2, result);
+        return;
+      }
+      if (auto *memIntrinsic = dyn_cast<AnyMemIntrinsic>(&I))
+        pointer = memIntrinsic->getRawDest();
+      else if (auto *rmw = dyn_cast<AtomicRMWInst>(&I))
+        pointer = rmw->getPointerOperand();
+      else if (auto *cmpxchg = dyn_cast<AtomicCmpXchgInst>(&I))
+        pointer = cmpxchg->getPointerOperand();
+      else
+        getAccessPointer(I, pointer);
+      countObjectBytes(pointer, bytes, result);
+    }
+
+    /**
+     * @brief Count the static metrics of a function.
+     *
+     * This only reads the IR of the function and never touches an analysis manager or the
+     * LLVMContext, so it is safe to call for different functions from different threads as long
+     * as each thread uses its own DataLayout (its struct layout cache is not thread-safe).
+     *
+     * @param F The LLVM function to count.
+     * @param DL The DataLayout of the module.
+     * @param counted The static counts to fill in.
+     */
+    void countFunction(Function &F, const DataLayout &DL, CountedFunction &counted) {
+      FunctionAnalysis &result = counted.analysis;
+      result.mangledName = F.getName().str();
+      result.demangledName = demangle(result.mangledName);
+
+      counted.blockTotals.reserve(F.size());
+      InstructionCounter counter(*this, DL, result);
+      bool countsObjects = isMetricGroupEnabled(MetricGroup::Objects);
+      bool countsAddressSpaces = isMetricGroupEnabled(MetricGroup::GPU);
+      bool recordsAccesses = isMetricGroupEnabled(MetricGroup::Strides) || countsAddressSpaces;
+      for (auto &BB : F) {
+        AccessTotals &blockTotals = counted.blockTotals.emplace_back();
+        for (auto &I : BB) {
+          counter.isDeferred = false;
+          AccessTotals counts = counter.visit(I);
+          if (counter.isDeferred)
+            counted.deferredIntrinsics.push_back({counted.blockTotals.size() - 1, cast<AnyMemIntrinsic>(&I)});
+          Value *pointer;
+          if (recordsAccesses && getAccessPointer(I, pointer))
+            counted.accesses.push_back({&I, pointer, counts.bytes});
+          if (countsObjects)
+            countInstructionObjects(I, counts.bytes, result);
+          if (countsAddressSpaces)
+            countInstructionAddressSpaces(I, counts.bytes, result);
+          result.loads += counts.loads;
+          result.stores += counts.stores;
+          result.bytes += counts.bytes;
+          result.flops += counts.flops;
+          result.intOps += counts.intOps;
+          blockTotals.add(counts);
+        }
+      }
+    }
+
+    /**
+     * @brief Classify the address of an access by how it changes across iterations of its innermost loop.
+     *
+     * Accesses outside of loops are invariant. An affine address of the innermost loop is unit
+     * stride if it advances by exactly the access size (in either direction), and strided for any
+     * other constant or loop-invariant step. Everything else, including gathers and addresses
+     * loaded from memory, is indirect: the hardware prefetchers cannot follow it.
+     *
+     * @param access The access.
+     * @param LI The LoopInfo analysis of the function.
+     * @param SE The ScalarEvolution analysis of the function.
+     * @return The stride class of the access.
+     */
+    StrideClass classifyStride(const PointerAccess &access, LoopInfo &LI, ScalarEvolution &SE) {
+      if (!access.pointer)
+        return StrideClass::Indirect;
+      const Loop *L = LI.getLoopFor(access.I->getParent());
+      if (!L)
+        return StrideClass::Invariant;
+
+      const SCEV *address = SE.getSCEV(access.pointer);
+      if (SE.isLoopInvariant(address, L))
+        return StrideClass::Invariant;
+      if (auto *addRec = dyn_cast<SCEVAddRecExpr>(address)) {
+        if (addRec->getLoop() == L && addRec->isAffine()) {
+          const SCEV *step = addRec->getStepRecurrence(SE);
+          if (auto *constant = dyn_cast<SCEVConstant>(step))
+            return constant->getAPInt().abs() == access.bytes ? StrideClass::UnitStride : StrideClass::Strided;
+          if (SE.isLoopInvariant(step, L))
+            return StrideClass::Strided;
+        }
+      }
+      return StrideClass::Indirect;
+    }
+
+    /**
+     * @brief Add the bytes of the recorded loads and stores of a function to their stride classes.
+     *
+     * With -memcheck-gpu, the global accesses are also classified as coalesced or not.
+     *
+     * @param F The LLVM function being analyzed.
+     * @param counted The static counts of the function, with its recorded accesses.
+     * @param FAM The FunctionAnalysisManager, used to get LoopInfo and ScalarEvolution.
+     */
+    void classifyAccesses(Function &F, CountedFunction &counted, FunctionAnalysisManager &FAM) {
+      if (counted.accesses.empty())
+        return;
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+      FunctionAnalysis &result = counted.analysis;
+      for (const PointerAccess &access : counted.accesses) {
+        if (GPUAnalysis && isGlobalAccess(access.pointer)) {
+          if (isCoalescedAccess(access, SE))
+            result.coalescedBytes += access.bytes;
+          else
+            result.uncoalescedBytes += access.bytes;
+        }
+        if (!StrideClassification)
+          continue;
+        switch (classifyStride(access, LI, SE)) {
+          case StrideClass::Invariant:
+            result.invariantBytes += access.bytes;
+            break;
+          case StrideClass::UnitStride:
+            result.unitStrideBytes += access.bytes;
+            break;
+          case StrideClass::Strided:
+            result.stridedBytes += access.bytes;
+            break;
+          case StrideClass::Indirect:
+            result.indirectBytes += access.bytes;
+            break;
+        }
+      }
+    }
+
+    /**
+     * @brief GPU address spaces, as numbered by both the NVPTX and the AMDGPU targets.
+     */
+    enum class GPUAddressSpace { Generic, Global, Shared, Constant, Private };
+
+    /**
+     * @brief Classify an NVPTX or AMDGPU address space.
+     *
+     * Both targets use 1 for global, 3 for shared memory (LDS), 4 for constant and 5 for private
+     * (local) memory. AMDGPU adds 32-bit constant pointers (6) and buffer pointers (7), which
+     * count as constant and global. Everything else, the generic (flat) space 0 included, is
+     * generic.
+     */
+    static GPUAddressSpace classifyAddressSpace(unsigned addressSpace) {
+      switch (addressSpace) {
+        case 1: case 7: return GPUAddressSpace::Global;
+        case 3: return GPUAddressSpace::Shared;
+        case 4: case 6: return GPUAddressSpace::Constant;
+        case 5: return GPUAddressSpace::Private;
+        default: return GPUAddressSpace::Generic;
+      }
+    }
+
+    /**
+     * @brief Add bytes to the category of the address space of an address (or vector of addresses).
+     */
+    static void countAddressSpaceBytes(const Value *pointer, uint64_t bytes, FunctionAnalysis &result) {
+      switch (classifyAddressSpace(pointer->getType()->getPointerAddressSpace())) {
+        case GPUAddressSpace::Generic: result.gpuGenericBytes += bytes; break;
+        case GPUAddressSpace::Global: result.gpuGlobalBytes += bytes; break;
+        case GPUAddressSpace::Shared: result.gpuSharedBytes += bytes; break;
+        case GPUAddressSpace::Constant: result.gpuConstantBytes += bytes; break;
+        case GPUAddressSpace::Private: result.gpuPrivateBytes += bytes; break;
+      }
+    }
+
+    /**
+     * @brief Attribute the bytes of an instruction to the address spaces of its addresses.
+     *
+     * Memory transfers split their bytes like countInstructionObjects; gathers and scatters use
+     * the address space of their vector of addresses.
+     *
+     * @param I The instruction.
+     * @param bytes The bytes counted for the instruction.
+     * @param result The analysis results whose address space categories are updated.
+     */
+    static void countInstructionAddressSpaces(Instruction &I, uint64_t bytes, FunctionAnalysis &result) {
+      if (!bytes)
+        return;
+      Value *pointer = nullptr;
+      if (auto *transfer = dyn_cast<AnyMemTransferInst>(&I)) {
+        countAddressSpaceBytes(transfer->getRawSource(), bytes / 2, result);
+        countAddressSpaceBytes(transfer->getRawDest(), bytes - bytes / 2, result);
+        return;
+      }
+      auto *intrinsic = dyn_cast<IntrinsicInst>(&I);
+      Intrinsic::ID intrinsicID = intrinsic ? intrinsic->getIntrinsicID() : Intrinsic::not_intrinsic;
+      if (auto *memIntrinsic = dyn_cast<AnyMemIntrinsic>(&I))
+        pointer = memIntrinsic->getRawDest();
+      else if (auto *rmw = dyn_cast<AtomicRMWInst>(&I))
+        pointer = rmw->getPointerOperand();
+      else if (auto *cmpxchg = dyn_cast<AtomicCmpXchgInst>(&I))
+        pointer = cmpxchg->getPointerOperand();
+      else if (intrinsicID == Intrinsic::masked_gather)
+        pointer = intrinsic->getArgOperand(0);
+      else if (intrinsicID == Intrinsic::masked_scatter)
+        pointer = intrinsic->getArgOperand(1);
+      else
+        getAccessPointer(I, pointer);
+      if (pointer)
+        countAddressSpaceBytes(pointer, bytes, result);
+    }
+
+    /**
+     * @brief Determines if a value is the x thread index of its block (workgroup).
+     */
+    static bool isThreadIndex(const Value *V) {
+      auto *intrinsic = dyn_cast<IntrinsicInst>(V);
+      return intrinsic && (intrinsic->getIntrinsicID() == Intrinsic::nvvm_read_ptx_sreg_tid_x ||
+                           intrinsic->getIntrinsicID() == Intrinsic::amdgcn_workitem_id_x);
+    }
+
+    /**
+     * @brief Determines if a value is any of the thread (work-item) or lane indices, which differ
+     *        between the threads of a warp (wavefront).
+     */
+    static bool isThreadDependentIndex(const Value *V) {
+      auto *intrinsic = dyn_cast<IntrinsicInst>(V);
+      if (!intrinsic)
+        return false;
+      switch (intrinsic->getIntrinsicID()) {
+      case Intrinsic::nvvm_read_ptx_sreg_tid_x:
+      case Intrinsic::nvvm_read_ptx_sreg_tid_y:
+      case Intrinsic::nvvm_read_ptx_sreg_tid_z:
+      case Intrinsic::nvvm_read_ptx_sreg_laneid:
+      case Intrinsic::amdgcn_workitem_id_x:
+      case Intrinsic::amdgcn_workitem_id_y:
+      case Intrinsic::amdgcn_workitem_id_z:
+      case Intrinsic::amdgcn_mbcnt_lo:
+      case Intrinsic::amdgcn_mbcnt_hi:
+        return true;
+      default:
+        return false;
+      }
+    }
+
+    /**
+     * @brief Determines if a value is the same for all threads of a warp (wavefront).
+     *
+     * Arguments, constants and the block and grid geometry intrinsics are, thread and lane
+     * indices are not (see isThreadDependentIndex); loads are if their address is, other
+     * instructions if all their operands are, up to a small depth.
+     *
+     * @param V The value.
+     * @param SE The ScalarEvolution analysis of the function.
+     * @param depth How many more instructions to look through.
+     */
+    static bool isWarpUniform(Value *V, ScalarEvolution &SE, unsigned depth) {
+      if (isa<Argument>(V) || isa<Constant>(V))
+        return true;
+      auto *I = dyn_cast<Instruction>(V);
+      if (!I || !depth)
+        return false;
+      if (auto *intrinsic = dyn_cast<IntrinsicInst>(I))
+        return !isThreadDependentIndex(intrinsic) && intrinsic->arg_empty() && !intrinsic->mayReadOrWriteMemory();
+      if (auto *load = dyn_cast<LoadInst>(I))
+        return !load->isVolatile() && getThreadStride(SE.getSCEV(load->getPointerOperand()), SE, depth - 1) == std::optional<int64_t>(0);
+      if (isa<CallBase>(I) || I->mayReadOrWriteMemory())
+        return false;
+      return llvm::all_of(I->operands(), [&](Value *operand) { return isWarpUniform(operand, SE, depth - 1); });
+    }
+
+    /**
+     * @brief Get how far an address moves from one thread of a warp (wavefront) to the next.
+     *
+     * The expression is differentiated along the x thread index: additions add the strides of
+     * their operands, multiplications by constants scale them, and casts are looked through,
+     * since thread indices are far too small to wrap. Recurrences of loops keep the stride of
+     * their start as long as their step is uniform. Any other value must be uniform (see
+     * isWarpUniform).
+     *
+     * @param S The address, or a part of it.
+     * @param SE The ScalarEvolution analysis of the function.
+     * @param depth How many more instructions isWarpUniform may look through.
+     * @return The stride in bytes, 0 if the address is uniform across threads, or nothing if it
+     *         is not affine in the thread index.
+     */
+    static std::optional<int64_t> getThreadStride(const SCEV *S, ScalarEvolution &SE, unsigned depth = 4) {
+      if (isa<SCEVConstant>(S))
+        return 0;
+      if (auto *unknown = dyn_cast<SCEVUnknown>(S)) {
+        if (isThreadIndex(unknown->getValue()))
+          return 1;
+        if (isWarpUniform(unknown->getValue(), SE, depth))
+          return 0;
+        return std::nullopt;
+      }
+      if (auto *cast = dyn_cast<SCEVCastExpr>(S))
+        return getThreadStride(cast->getOperand(), SE, depth);
+      if (auto *udiv = dyn_cast<SCEVUDivExpr>(S)) {
+        if (getThreadStride(udiv->getLHS(), SE, depth) == std::optional<int64_t>(0) &&
+            getThreadStride(udiv->getRHS(), SE, depth) == std::optional<int64_t>(0))
+          return 0;
+        return std::nullopt;
+      }
+      auto *nary = dyn_cast<SCEVNAryExpr>(S);
+      if (!nary)
+        return std::nullopt;
+
+      SmallVector<int64_t, 4> strides;
+      for (const SCEV *operand : nary->operands()) {
+        std::optional<int64_t> stride = getThreadStride(operand, SE, depth);
+        if (!stride)
+          return std::nullopt;
+        strides.push_back(*stride);
+      }
+      if (llvm::all_of(strides, [](int64_t stride) { return stride == 0; }))
+        return 0;
+      if (isa<SCEVAddExpr>(nary)) {
+        int64_t sum = 0;
+        for (int64_t stride : strides) {
+          sum += stride;
+          if (!isInt<32>(sum))
+            return std::nullopt;
+        }
+        return sum;
+      }
+      if (isa<SCEVMulExpr>(nary)) {
+        /* Constants times a single operand that depends on the thread */
+        int64_t product = 1;
+        bool hasStride = false;
+        for (size_t i = 0; i < strides.size(); ++i) {
+          if (auto *constant = dyn_cast<SCEVConstant>(nary->getOperand(i))) {
+            if (!constant->getAPInt().isSignedIntN(32))
+              return std::nullopt;
+            product *= constant->getAPInt().getSExtValue();
+          } else if (strides[i] && !hasStride) {
+            hasStride = true;
+            product *= strides[i];
+          } else {
+            return std::nullopt;
+          }
+          if (!isInt<32>(product))
+            return std::nullopt;
+        }
+        return product;
+      }
+      /* A recurrence keeps the stride of its start if its step is uniform */
+      if (auto *addRec = dyn_cast<SCEVAddRecExpr>(nary)) {
+        if (addRec->isAffine() && strides[1] == 0)
+          return strides[0];
+      }
+      return std::nullopt;
+    }
+
+    /**
+     * @brief Determines if an access goes to global memory, as far as the address space tells.
+     *
+     * Generic pointers of device code mostly point to global memory (CUDA kernels take their
+     * arguments as generic pointers), so they count as global unless they point to an alloca.
+     */
+    static bool isGlobalAccess(const Value *pointer) {
+      if (!pointer)
+        return true;
+      switch (classifyAddressSpace(pointer->getType()->getPointerAddressSpace())) {
+        case GPUAddressSpace::Global: return true;
+        case GPUAddressSpace::Generic: return classifyObject(pointer) != ObjectClass::Stack;
+        default: return false;
+      }
+    }
+
+    /**
+     * @brief Determines if the threads of a warp (wavefront) access memory in a coalesced way.
+     *
+     * An access is coalesced if neighboring threads access neighboring elements (the address moves
+     * by the access size from one thread to the next) or all access the same address. Gathers,
+     * scatters and addresses that are not affine in the thread index are uncoalesced.
+     *
+     * @param access The access.
+     * @param SE The ScalarEvolution analysis of the function.
+     */
+    static bool isCoalescedAccess(const PointerAccess &access, ScalarEvolution &SE) {
+      if (!access.pointer)
+        return false;
+      std::optional<int64_t> stride = getThreadStride(SE.getSCEV(access.pointer), SE);
+      return stride && (*stride == 0 || uint64_t(std::abs(*stride)) == access.bytes);
+    }
+
+    /**
+     * @brief Find the kernels listed in the nvvm.annotations of a module.
+     *
+     * Each kernel has an operand !{ptr @kernel, !"kernel", i32 1}.
+     */
+    void findAnnotatedKernels(Module &M) {
+      annotatedKernels.clear();
+      NamedMDNode *annotations = M.getNamedMetadata("nvvm.annotations");
+      if (!annotations)
+        return;
+      for (const MDNode *annotation : annotations->operands()) {
+        if (annotation->getNumOperands() < 3)
+          continue;
+        auto *kind = dyn_cast<MDString>(annotation->getOperand(1));
+        auto *value = mdconst::dyn_extract_or_null<ConstantInt>(annotation->getOperand(2));
+        if (kind && kind->getString() == "kernel" && value && value->isOne())
+          if (auto *F = mdconst::dyn_extract_or_null<Function>(annotation->getOperand(0)))
+            annotatedKernels.insert(F);
+      }
+    }
+
+    /**
+     * @brief Determines if a function is a GPU kernel entry point.
+     *
+     * Kernels have a kernel calling convention (PTX, AMDGPU or SPIR), are listed in the
+     * nvvm.annotations of the module, or have the work group size attribute clang gives every
+     * AMDGPU kernel.
+     */
+    bool isGPUKernel(const Function &F) const {
+      switch (F.getCallingConv()) {
+        case CallingConv::PTX_Kernel:
+        case CallingConv::AMDGPU_KERNEL:
+        case CallingConv::SPIR_KERNEL:
+          return true;
+        default:
+          return annotatedKernels.count(&F) || F.hasFnAttribute("amdgpu-flat-work-group-size");
+      }
+    }
+
+    /**
+     * @brief A load or store whose memory traffic could be avoided.
+     */
+    struct AvoidableAccess {
+      Instruction *I;
+      bool isDeadStore;  /* A dead store, otherwise a redundant load */
+      uint64_t bytes;
+    };
+
+    /* Avoidable accesses found by finishFunction, kept for the redundancy report (see writeAvoidableAccesses) */
+    DenseMap<const Function *, SmallVector<AvoidableAccess, 8>> avoidableAccesses;
+
+    /**
+     * @brief Find the redundant loads and dead stores of a function.
+     *
+     * A load is redundant if its clobbering access in MemorySSA is a store to the same location of
+     * at least its size (the value can be forwarded), or if a dominating load of the same location
+     * has the same clobber (the value can be reused). A store is dead if a later store of the same
+     * block overwrites all of it before any access that may read it or any instruction that may
+     * throw. Volatile and atomic accesses are never reported. Stores overwritten in another block
+     * are not looked for.
+     *
+     * @param F The LLVM function being analyzed.
+     * @param FAM The FunctionAnalysisManager, used to get MemorySSA, AAResults and the DominatorTree.
+     * @param found The avoidable accesses, loads in dominator tree order first.
+     */
+    void findAvoidableAccesses(Function &F, FunctionAnalysisManager &FAM, SmallVectorImpl<AvoidableAccess> &found) {
+      MemorySSA &MSSA = FAM.getResult<MemorySSAAnalysis>(F).getMSSA();
+      AAResults &AA = FAM.getResult<AAManager>(F);
+      DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+      const DataLayout &DL = F.getParent()->getDataLayout();
+      auto isMustAlias = [&](const MemoryLocation &a, const MemoryLocation &b) {
+        return AA.alias(a, b) == AliasResult::MustAlias;
+      };
+
+      /* Loads seen so far, by clobbering access; dominator tree order puts dominating loads first */
+      DenseMap<MemoryAccess *, SmallVector<LoadInst *, 4>> loadsByClobber;
+      for (DomTreeNode *node : depth_first(DT.getRootNode())) {
+        for (Instruction &I : *node->getBlock()) {
+          auto *load = dyn_cast<LoadInst>(&I);
+          if (!load || !load->isSimple())
+            continue;
+          MemoryAccess *clobber = MSSA.getWalker()->getClobberingMemoryAccess(load);
+          MemoryLocation location = MemoryLocation::get(load);
+          uint64_t bytes = getTypeAccessBytes(DL, load->getType());
+
+          bool isRedundant = false;
+          if (auto *def = dyn_cast<MemoryDef>(clobber)) {
+            auto *store = dyn_cast_or_null<StoreInst>(def->getMemoryInst());
+            isRedundant = store && store->isSimple() &&
+                          getTypeAccessBytes(DL, store->getValueOperand()->getType()) >= bytes &&
+                          isMustAlias(MemoryLocation::get(store), location);
+          }
+          SmallVector<LoadInst *, 4> &sameClobber = loadsByClobber[clobber];
+          for (size_t i = 0; i < sameClobber.size() && !isRedundant; ++i) {
+            isRedundant = getTypeAccessBytes(DL, sameClobber[i]->getType()) >= bytes &&
+                          DT.dominates(sameClobber[i], load) &&
+                          isMustAlias(MemoryLocation::get(sameClobber[i]), location);
+          }
+          if (isRedundant)
+            found.push_back({load, /*isDeadStore=*/false, bytes});
+          sameClobber.push_back(load);
+        }
+      }
+
+      for (BasicBlock &BB : F) {
+        const MemorySSA::AccessList *accesses = MSSA.getBlockAccesses(&BB);
+        if (!accesses)
+          continue;
+        for (auto access = accesses->begin(); access != accesses->end(); ++access) {
+          auto *def = dyn_cast<MemoryDef>(&*access);
+          auto *store = def ? dyn_cast_or_null<StoreInst>(def->getMemoryInst()) : nullptr;
+          if (!store || !store->isSimple())
+            continue;
+          MemoryLocation location = MemoryLocation::get(store);
+          uint64_t bytes = getTypeAccessBytes(DL, store->getValueOperand()->getType());
+
+          /* Accesses after a MemoryDef are never MemoryPhis */
+          for (auto later = std::next(access); later != accesses->end(); ++later) {
+            Instruction *laterInst = cast<MemoryUseOrDef>(&*later)->getMemoryInst();
+            auto *laterStore = dyn_cast<StoreInst>(laterInst);
+            if (laterStore && laterStore->isSimple() &&
+                getTypeAccessBytes(DL, laterStore->getValueOperand()->getType()) >= bytes &&
+                isMustAlias(MemoryLocation::get(laterStore), location)) {
+              /* Calls that touch no memory have no MemorySSA access, but may still unwind */
+              bool mayThrow = false;
+              for (Instruction *I = store->getNextNode(); I != laterStore && !mayThrow; I = I->getNextNode())
+                mayThrow = I->mayThrow();
+              if (!mayThrow)
+                found.push_back({store, /*isDeadStore=*/true, bytes});
+              break;
+            }
+            if (isRefSet(AA.getModRefInfo(laterInst, location)) || laterInst->mayThrow())
+              break;
+          }
+        }
+      }
+    }
+
+    /**
+     * @brief Get the number of threads assumed for OpenMP parallel regions.
+     */
+    static unsigned getOpenMPThreads() {
+      if (OpenMPThreads)
+        return OpenMPThreads;
+      unsigned threads = 0;
+      if (const char *env = std::getenv("OMP_NUM_THREADS"))
+        threads = std::atoi(env);
+      return threads ? threads : std::max(1u, hardware_concurrency().compute_thread_count());
+    }
+
+    /**
+     * @brief Find the outlined parallel region bodies of a module and the functions forking them.
+     *
+     * Recognizes the fork entry points of libomp (__kmpc_fork_call, __kmpc_fork_teams and their
+     * variants; __kmpc_omp_task_alloc for tasks) and of libgomp (GOMP_parallel*, GOMP_teams*,
+     * GOMP_task), whose outlined function is a fixed argument.
+     *
+     * @param M The LLVM module being analyzed.
+     */
+    void findParallelRegions(Module &M) {
+      parallelRegions.clear();
+      for (Function &F : M) {
+        for (Instruction &I : instructions(F)) {
+          auto *call = dyn_cast<CallBase>(&I);
+          Function *callee = call ? call->getCalledFunction() : nullptr;
+          if (!callee)
+            continue;
+          StringRef name = callee->getName();
+          unsigned outlinedArgument;
+          bool hasThreadIdArgument = name.startswith("__kmpc_");
+          if (name.startswith("__kmpc_fork_call") || name.startswith("__kmpc_fork_teams"))
+            outlinedArgument = 2;
+          else if (name == "__kmpc_omp_task_alloc" || name == "__kmpc_omp_target_task_alloc")
+            outlinedArgument = 5;
+          else if (name.startswith("GOMP_parallel") || name.startswith("GOMP_teams") || name == "GOMP_task")
+            outlinedArgument = 0;
+          else
+            continue;
+          if (call->arg_size() <= outlinedArgument)
+            continue;
+          if (auto *outlined = dyn_cast<Function>(call->getArgOperand(outlinedArgument)->stripPointerCasts()))
+            parallelRegions.try_emplace(outlined, ParallelRegion{&F, hasThreadIdArgument});
+        }
+      }
+    }
+
+    /**
+     * @brief Get the iterations of a worksharing loop from the bounds passed to its static init call.
+     *
+     * The bounds are read from the constant (or SCEV-constant) stores to the lower and upper bound
+     * slots that dominate the call; the runtime then hands each thread its share of them.
+     *
+     * @param init The __kmpc_for_static_init (or dispatch_init) call.
+     * @param DT The DominatorTree of the function.
+     * @param SE The ScalarEvolution analysis of the function.
+     * @return The total iterations, or 0 if the bounds are not known.
+     */
+    uint64_t getWorksharingIterations(CallBase &init, DominatorTree &DT, ScalarEvolution &SE) {
+      bool isDispatch = init.getCalledFunction()->getName().startswith("__kmpc_dispatch_init");
+      /* static_init(loc, gtid, schedule, plastiter, plower, pupper, ...), dispatch_init(loc, gtid, schedule, lb, ub, ...) */
+      unsigned lowerArgument = isDispatch ? 3 : 4;
+      if (init.arg_size() <= lowerArgument + 1)
+        return 0;
+      auto getBound = [&](Value *bound) -> std::optional<int64_t> {
+        if (!bound->getType()->isPointerTy()) {
+          if (auto *constant = dyn_cast<SCEVConstant>(SE.getSCEV(bound)))
+            return constant->getAPInt().getSExtValue();
+          return std::nullopt;
+        }
+        std::optional<int64_t> value;
+        for (User *user : bound->stripPointerCasts()->users()) {
+          auto *store = dyn_cast<StoreInst>(user);
+          if (!store || store->getPointerOperand()->stripPointerCasts() != bound->stripPointerCasts() ||
+              !DT.dominates(store, &init))
+            continue;
+          auto *constant = dyn_cast<SCEVConstant>(SE.getSCEV(store->getValueOperand()));
+          if (!constant || value)
+            return std::nullopt;
+          value = constant->getAPInt().getSExtValue();
+        }
+        return value;
+      };
+      std::optional<int64_t> lower = getBound(init.getArgOperand(lowerArgument));
+      std::optional<int64_t> upper = getBound(init.getArgOperand(lowerArgument + 1));
+      if (!lower || !upper || *upper < *lower)
+        return 0;
+      return uint64_t(*upper - *lower) + 1;
+    }
+
+    /**
+     * @brief Estimate the bytes of an outlined parallel region, over all threads and per thread.
+     *
+     * Code outside of worksharing loops runs on every thread. A worksharing loop is the outermost
+     * loop dominated by a __kmpc_for_static_init or __kmpc_dispatch_init call; its iterations are
+     * split evenly across the threads, as under a static schedule, and its own trip count is
+     * replaced by the iterations given to the runtime (or -memcheck-default-trip-count).
+     *
+     * @param F The outlined function.
+     * @param counted The static counts of the function, with constant-length intrinsics resolved.
+     * @param FAM The FunctionAnalysisManager.
+     */
+    void computeParallelBytes(Function &F, CountedFunction &counted, FunctionAnalysisManager &FAM) {
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+      DominatorTree &DT = FAM.getResult<DominatorTreeAnalysis>(F);
+      uint64_t threads = getOpenMPThreads();
+
+      /* Worksharing loops and their total iterations */
+      DenseMap<const Loop *, uint64_t> worksharingLoops;
+      for (Instruction &I : instructions(F)) {
+        auto *call = dyn_cast<CallBase>(&I);
+        Function *callee = call ? call->getCalledFunction() : nullptr;
+        if (!callee || !(callee->getName().startswith("__kmpc_for_static_init") ||
+                         callee->getName().startswith("__kmpc_dist_for_static_init") ||
+                         callee->getName().startswith("__kmpc_dispatch_init")))
+          continue;
+        uint64_t iterations = getWorksharingIterations(*call, DT, SE);
+        for (const Loop *L : LI.getLoopsInPreorder()) {
+          if (L->contains(call) || !DT.dominates(call->getParent(), L->getHeader()))
+            continue;
+          const Loop *outer = L->getParentLoop();
+          while (outer && !outer->contains(call))
+            outer = outer->getParentLoop();
+          /* Only the outermost dominated loop, not its inner loops */
+          if (L->getParentLoop() == outer && !worksharingLoops.count(L))
+            worksharingLoops[L] = iterations ? iterations : DefaultTripCount.getValue();
+        }
+      }
+
+      uint64_t perThread = 0, total = 0;
+      unsigned blockIndex = 0;
+      for (BasicBlock &BB : F) {
+        uint64_t bytes = counted.blockTotals[blockIndex++].bytes;
+        if (!bytes)
+          continue;
+        uint64_t weight = 1;
+        uint64_t iterations = 0;
+        for (const Loop *L = LI.getLoopFor(&BB); L; L = L->getParentLoop()) {
+          auto worksharing = worksharingLoops.find(L);
+          if (worksharing != worksharingLoops.end() && !iterations)
+            iterations = worksharing->second;
+          else
+            weight = SaturatingMultiply(weight, getTripCount(L, SE).estimate);
+        }
+        uint64_t blockBytes = SaturatingMultiply(bytes, weight);
+        if (iterations) {
+          perThread = SaturatingAdd(perThread, SaturatingMultiply(blockBytes, divideCeil(iterations, threads)));
+          total = SaturatingAdd(total, SaturatingMultiply(blockBytes, iterations));
+        } else {
+          perThread = SaturatingAdd(perThread, blockBytes);
+          total = SaturatingAdd(total, SaturatingMultiply(blockBytes, threads));
+        }
+      }
+      counted.analysis.perThreadBytes = perThread;
+      counted.analysis.parallelBytes = total;
+    }
+
+    /**
+     * @brief Determines if a value is computed from the OpenMP thread id.
+     * @param V The value, typically a GEP index.
+     * @param region The parallel region of the function.
+     * @param depth The recursion depth.
+     */
+    static bool isThreadIdDerived(const Value *V, const Function &F, const ParallelRegion &region, unsigned depth = 0) {
+      if (depth > 4)
+        return false;
+      if (auto *call = dyn_cast<CallBase>(V)) {
+        Function *callee = call->getCalledFunction();
+        return callee && (callee->getName() == "omp_get_thread_num" || callee->getName() == "__kmpc_global_thread_num");
+      }
+      if (auto *load = dyn_cast<LoadInst>(V)) {
+        if (!region.hasThreadIdArgument || F.arg_empty())
+          return false;
+        /* The thread id argument, possibly spilled to an alloca at -O0 */
+        const Value *pointer = load->getPointerOperand()->stripPointerCasts();
+        const Argument *threadId = F.getArg(0);
+        if (pointer == threadId)
+          return true;
+        if (auto *reload = dyn_cast<LoadInst>(pointer)) {
+          for (const User *user : reload->getPointerOperand()->users()) {
+            if (auto *store = dyn_cast<StoreInst>(user))
+              if (store->getValueOperand() == threadId)
+                return true;
+          }
+        }
+        return false;
+      }
+      if (auto *cast = dyn_cast<CastInst>(V))
+        return isThreadIdDerived(cast->getOperand(0), F, region, depth + 1);
+      if (auto *binary = dyn_cast<BinaryOperator>(V))
+        return isThreadIdDerived(binary->getOperand(0), F, region, depth + 1) ||
+               isThreadIdDerived(binary->getOperand(1), F, region, depth + 1);
+      return false;
+    }
+
+    /**
+     * @brief Get the struct field accessed through an address.
+     *
+     * The address must be a GEP (possibly behind bitcasts) with a struct index; the field is the
+     * one selected by the last struct index, so an element of an array field counts as the field.
+     *
+     * @param address The accessed address.
+     * @param structTy Set to the innermost indexed struct type.
+     * @param field Set to the index of the field in that struct.
+     * @return The GEP, or nullptr if the address does not select a struct field.
+     */
+    static GEPOperator *getAccessedField(Value *address, StructType *&structTy, unsigned &field) {
+      /* Not stripPointerCasts, which also strips the all-zero GEP of the first field */
+      while (auto *cast = dyn_cast<BitCastOperator>(address))
+        address = cast->getOperand(0);
+      auto *gep = dyn_cast<GEPOperator>(address);
+      if (!gep)
+        return nullptr;
+      structTy = nullptr;
+      for (gep_type_iterator index = gep_type_begin(gep); index != gep_type_end(gep); ++index) {
+        if (StructType *indexedStruct = index.getStructTypeOrNull()) {
+          structTy = indexedStruct;
+          field = cast<ConstantInt>(index.getOperand())->getZExtValue();
+        }
+      }
+      return structTy && !structTy->isOpaque() ? gep : nullptr;
+    }
+
+    /**
+     * @brief Find the stores of a parallel region that may falsely share a cache line.
+     *
+     * Stores to private memory (allocas of the region) are ignored. A store is thread-indexed if
+     * an index of its address is computed from the thread id and the elements of that index are
+     * smaller than a cache line, e.g. per-thread counters in an array. Stores to different fields
+     * of the same shared struct that lie in the same cache line are flagged as adjacent fields.
+     *
+     * @param F The outlined function.
+     * @param region The parallel region of the function.
+     * @param hints The potential false-sharing stores.
+     */
+    void findFalseSharingStores(Function &F, const ParallelRegion &region, SmallVectorImpl<FalseSharingHint> &hints) {
+      const DataLayout &DL = F.getParent()->getDataLayout();
+      uint64_t lineSize = std::max(1u, CacheLineSize.getValue());
+      /* Stored field offsets by shared object and struct type */
+      MapVector<std::pair<const Value *, StructType *>, SmallVector<std::pair<StoreInst *, uint64_t>, 4>> fieldStores;
+
+      for (Instruction &I : instructions(F)) {
+        auto *store = dyn_cast<StoreInst>(&I);
+        if (!store || isa<AllocaInst>(getUnderlyingObject(store->getPointerOperand())))
+          continue;
+        /* Not stripPointerCasts, which also strips the all-zero GEP of the first field */
+        Value *address = store->getPointerOperand();
+        while (auto *cast = dyn_cast<BitCastOperator>(address))
+          address = cast->getOperand(0);
+        auto *gep = dyn_cast<GEPOperator>(address);
+        if (!gep)
+          continue;
+
+        bool isThreadIndexed = false;
+        for (gep_type_iterator index = gep_type_begin(gep); index != gep_type_end(gep) && !isThreadIndexed; ++index) {
+          if (index.isStruct())
+            continue;
+          uint64_t stride = DL.getTypeAllocSize(index.getIndexedType()).getKnownMinValue();
+          if (stride < lineSize && isThreadIdDerived(index.getOperand(), F, region)) {
+            hints.push_back({store, "thread-indexed", stride});
+            isThreadIndexed = true;
+          }
+        }
+        if (isThreadIndexed)
+          continue;
+
+        /* A field of a struct, at a fixed offset from the shared object */
+        StructType *structTy;
+        unsigned field;
+        if (!gep->hasAllConstantIndices() || !getAccessedField(gep, structTy, field))
+          continue;
+        uint64_t offset = DL.getStructLayout(structTy)->getElementOffset(field);
+        fieldStores[{getUnderlyingObject(gep->getPointerOperand()), structTy}].push_back({store, offset});
+      }
+
+      for (const auto &entry : fieldStores) {
+        for (const auto &fieldStore : entry.second) {
+          std::optional<uint64_t> distance;
+          for (const auto &other : entry.second) {
+            if (other.second != fieldStore.second && other.second / lineSize == fieldStore.second / lineSize) {
+              uint64_t apart = other.second > fieldStore.second ? other.second - fieldStore.second
+                                                                : fieldStore.second - other.second;
+              distance = distance ? std::min(*distance, apart) : apart;
+            }
+          }
+          if (distance)
+            hints.push_back({fieldStore.first, "adjacent fields", *distance});
+        }
+      }
+    }
+
+    /**
+     * @brief Complete the analysis of a counted function with the analyses that need a FunctionAnalysisManager.
+     *
+     * Resolves the lengths of non-constant memory intrinsics with ScalarEvolution and classifies
+     * the strides of the recorded accesses, then applies loop weighting and profile weighting to
+     * the per-block totals.
+     *
+     * @param F The LLVM function being analyzed.
+     * @param counted The static counts of the function.
+     * @param FAM The FunctionAnalysisManager, used to get LoopInfo and ScalarEvolution.
+     * @return A FunctionAnalysis struct containing the analysis results.
+     */
+    FunctionAnalysis finishFunction(Function &F, CountedFunction &counted, FunctionAnalysisManager &FAM) {
+      FunctionAnalysis &result = counted.analysis;
+
+      /* Memory intrinsic lengths that ScalarEvolution can fold to a constant */
+      if (!counted.deferredIntrinsics.empty()) {
+        ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+        for (const auto &deferred : counted.deferredIntrinsics) {
+          if (auto *length = dyn_cast<SCEVConstant>(SE.getSCEV(deferred.second->getLength()))) {
+            uint64_t bytes = getMemIntrinsicBytes(deferred.second, length->getAPInt().getLimitedValue());
+            result.memIntrinsicBytes += bytes;
+            result.bytes += bytes;
+            counted.blockTotals[deferred.first].bytes += bytes;
+            if (isMetricGroupEnabled(MetricGroup::Objects))
+              countInstructionObjects(*deferred.second, bytes, result);
+            if (isMetricGroupEnabled(MetricGroup::GPU))
+              countInstructionAddressSpaces(*deferred.second, bytes, result);
+          } else {
+            result.unknownLengthMemIntrinsics++;
+          }
+        }
+      }
+
+      classifyAccesses(F, counted, FAM);
+
+      if (isMetricGroupEnabled(MetricGroup::OpenMP)) {
+        auto region = parallelRegions.find(&F);
+        if (region != parallelRegions.end()) {
+          computeParallelBytes(F, counted, FAM);
+          SmallVector<FalseSharingHint, 4> hints;
+          findFalseSharingStores(F, region->second, hints);
+          result.falseSharingStores = hints.size();
+        }
+      }
+
+      if (isMetricGroupEnabled(MetricGroup::Redundancy)) {
+        SmallVector<AvoidableAccess, 8> &avoidable = avoidableAccesses[&F];
+        findAvoidableAccesses(F, FAM, avoidable);
+        for (const AvoidableAccess &access : avoidable) {
+          if (access.isDeadStore) {
+            result.deadStores++;
+            result.deadStoreBytes += access.bytes;
+          } else {
+            result.redundantLoads++;
+            result.redundantLoadBytes += access.bytes;
+          }
+        }
+      }
+
+      LoopInfo *LI = isMetricGroupEnabled(MetricGroup::Loops) ? &FAM.getResult<LoopAnalysis>(F) : nullptr;
+      DenseMap<const Loop *, AccessTotals> loopTotals;
+
+      /* Block profile counts are only meaningful if the function itself has an entry count */
+      BlockFrequencyInfo *BFI = nullptr;
+      if (PSI) {
+        if (auto entryCount = F.getEntryCount()) {
+          BFI = &FAM.getResult<BlockFrequencyAnalysis>(F);
+          result.entryCount = entryCount->getCount();
+          result.isHot = PSI->isFunctionEntryHot(&F);
+        }
+      }
+
+      unsigned blockIndex = 0;
+      for (auto &BB : F) {
+        const AccessTotals &blockTotals = counted.blockTotals[blockIndex++];
+        if (LI)
+          loopTotals[LI->getLoopFor(&BB)].add(blockTotals);
+
+        /* Weight the block by the number of times it executed in the profiled runs */
+        if (BFI) {
+          if (auto count = BFI->getBlockProfileCount(&BB)) {
+            result.profLoads = SaturatingAdd(result.profLoads, SaturatingMultiply<uint64_t>(blockTotals.loads, *count));
+            result.profStores = SaturatingAdd(result.profStores, SaturatingMultiply<uint64_t>(blockTotals.stores, *count));
+            result.profBytes = SaturatingAdd(result.profBytes, SaturatingMultiply<uint64_t>(blockTotals.bytes, *count));
+            result.profFlops = SaturatingAdd(result.profFlops, SaturatingMultiply<uint64_t>(blockTotals.flops, *count));
+            result.profIntOps = SaturatingAdd(result.profIntOps, SaturatingMultiply<uint64_t>(blockTotals.intOps, *count));
+          }
+        }
+      }
+
+      /* Weight the per-loop totals by the trip counts of their loop nests */
+      if (LI)
+        computeDynamicCounts(F, loopTotals, FAM.getResult<ScalarEvolutionAnalysis>(F), result);
+
+      return result;
+    }
+
+    /**
+     * @brief Analyze a function and compute its metrics.
+     * @param F The LLVM function to analyze.
+     * @param analysisMap Results of the functions analyzed so far.
+     * @param FAM The FunctionAnalysisManager, used to get LoopInfo and ScalarEvolution.
+     * @return A FunctionAnalysis struct containing the analysis results.
+     */
+    FunctionAnalysis analyzeFunction(Function &F, std::map<Function *, FunctionAnalysis> &analysisMap,
+                                     FunctionAnalysisManager &FAM) {
+      /* Check if the function has already been analyzed */
+      auto it = analysisMap.find(&F);
+      if (it != analysisMap.end()) {
+        /* If the function has already been analyzed, return the stored results */
+        return it->second;
+      }
+
+      CountedFunction counted;
+      countFunction(F, F.getParent()->getDataLayout(), counted);
+      FunctionAnalysis result = finishFunction(F, counted, FAM);
+      /* Store the analysis results in the map */
+      analysisMap[&F] = result;
+
+      return result;
+    }
+
+    /**
+     * @brief Read the machine model of -memcheck-machine.
+     *
+     *   {"peak_gflops": 2000, "bandwidth_gbs": {"L1": 4000, "L2": 1500, "LLC": 600, "DRAM": 100}}
+     *
+     * Only the DRAM bandwidth is required, a missing cache level takes the bandwidth of the next
+     * outer one.
+     *
+     * @param fileName The machine description file.
+     * @return The machine model, or nothing if the file cannot be read or is invalid.
+     */
+    static std::optional<MachineModel> loadMachineModel(StringRef fileName) {
+      auto file = MemoryBuffer::getFile(fileName);
+      if (!file) {
+        errs() << "Error: cannot read " << fileName << ": " << file.getError().message() << "\n";
+        return std::nullopt;
+      }
+      Expected<json::Value> root = json::parse((*file)->getBuffer());
+      if (!root) {
+        errs() << "Error: invalid machine model " << fileName << ": " << toString(root.takeError()) << "\n";
+        return std::nullopt;
+      }
+      const json::Object *object = root->getAsObject();
+      const json::Object *bandwidths = object ? object->getObject("bandwidth_gbs") : nullptr;
+      if (!bandwidths) {
+        errs() << "Error: machine model " << fileName << " has no bandwidth_gbs object\n";
+        return std::nullopt;
+      }
+      auto peak = object->getNumber("peak_gflops");
+      auto dram = bandwidths->getNumber("DRAM");
+      if (!peak || !dram || *peak <= 0 || *dram <= 0) {
+        errs() << "Error: machine model " << fileName << " needs a positive peak_gflops and bandwidth_gbs.DRAM\n";
+        return std::nullopt;
+      }
+
+      MachineModel model;
+      model.peakGFlops = *peak;
+      auto getBandwidth = [&](StringRef level, double outer) {
+        auto bandwidth = bandwidths->getNumber(level);
+        return bandwidth && *bandwidth > 0 ? *bandwidth : outer;
+      };
+      model.dramBandwidth = *dram;
+      model.llcBandwidth = getBandwidth("LLC", model.dramBandwidth);
+      model.l2Bandwidth = getBandwidth("L2", model.llcBandwidth);
+      model.l1Bandwidth = getBandwidth("L1", model.l2Bandwidth);
+      return model;
+    }
+
+    /**
+     * @brief Place code on the roofline of the machine model.
+     *
+     * The code takes the longer of moving its bytes at the bandwidth and computing its flops at
+     * the peak; it is memory bound if moving the bytes takes longer, i.e. if its intensity is
+     * below the ridge point peak / bandwidth.
+     *
+     * @param flops The floating-point operations of the code.
+     * @param bytes The bytes loaded and stored by the code.
+     * @param bandwidth The bandwidth serving the bytes in GB/s, unused without a machine model.
+     * @return The intensity, and without a machine model nothing else.
+     */
+    RooflinePoint getRooflinePoint(uint64_t flops, uint64_t bytes, double bandwidth) const {
+      RooflinePoint point;
+      if (!flops && !bytes)
+        return point;
+      raw_string_ostream intensityStream(point.intensity);
+      if (bytes)
+        intensityStream << format("%.3f", double(flops) / bytes);
+      else
+        intensityStream << "inf";
+      intensityStream.flush();
+      if (!machineModel)
+        return point;
+
+      /* GB/s and GFLOP/s are bytes and flops per ns */
+      double memoryTime = bytes / bandwidth;
+      double computeTime = flops / machineModel->peakGFlops;
+      point.isMemoryBound = memoryTime > computeTime;
+      double attainable = bytes ? std::min(machineModel->peakGFlops, double(flops) / bytes * bandwidth)
+                                : machineModel->peakGFlops;
+      raw_string_ostream(point.attainableGFlops) << format("%.1f", attainable);
+      if (point.isMemoryBound)
+        point.memoryExcessTime = uint64_t(std::min((memoryTime - computeTime) * 1000, double(std::numeric_limits<int64_t>::max())));
+      return point;
+    }
+
+    /**
+     * @brief Place a function on the roofline, with the counts of its most precise model.
+     *
+     * The bytes of a whole function are assumed to come from DRAM; the loop report uses the
+     * cache level the footprint of each loop fits in.
+     *
+     * @param analysis The analysis results of the function.
+     */
+    void placeOnRoofline(FunctionAnalysis &analysis) const {
+      double bandwidth = machineModel ? machineModel->dramBandwidth : 0;
+      if (PSI && analysis.entryCount)
+        analysis.roofline = getRooflinePoint(analysis.profFlops, analysis.profBytes, bandwidth);
+      else if (LoopWeighting)
+        analysis.roofline = getRooflinePoint(analysis.dynFlops, analysis.dynBytes, bandwidth);
+      else
+        analysis.roofline = getRooflinePoint(analysis.flops, analysis.bytes, bandwidth);
+    }
+
+    /**
+     * @brief Append a stable encoding of a type to a hash buffer.
+     *
+     * Pointee types are not followed; the accessed types already appear on the loads and stores.
+     */
+    static void encodeType(Type *T, std::string &buffer) {
+      buffer += char(T->getTypeID());
+      if (auto *intTy = dyn_cast<IntegerType>(T)) {
+        buffer += utostr(intTy->getBitWidth());
+      } else if (auto *vecTy = dyn_cast<VectorType>(T)) {
+        buffer += utostr(vecTy->getElementCount().getKnownMinValue());
+        encodeType(vecTy->getElementType(), buffer);
+      } else if (auto *arrayTy = dyn_cast<ArrayType>(T)) {
+        buffer += utostr(arrayTy->getNumElements());
+        encodeType(arrayTy->getElementType(), buffer);
+      } else if (auto *structTy = dyn_cast<StructType>(T)) {
+        buffer += structTy->isPacked() ? 'p' : 'u';
+        buffer += utostr(structTy->getNumElements());
+        for (Type *element : structTy->elements())
+          encodeType(element, buffer);
+      } else if (auto *ptrTy = dyn_cast<PointerType>(T)) {
+        buffer += utostr(ptrTy->getAddressSpace());
+      }
+      buffer += ';';
+    }
+
+    /**
+     * @brief Append a stable encoding of an operand to a hash buffer.
+     * @param V The operand.
+     * @param numbering Local numbers of the arguments, basic blocks and instructions of the function.
+     * @param buffer The hash buffer.
+     */
+    static void encodeOperand(const Value *V, const DenseMap<const Value *, unsigned> &numbering,
+                              std::string &buffer) {
+      auto it = numbering.find(V);
+      if (it != numbering.end()) {
+        buffer += 'L' + utostr(it->second);
+      } else if (auto *constInt = dyn_cast<ConstantInt>(V)) {
+        buffer += 'I' + utostr(constInt->getBitWidth()) + ':' + toString(constInt->getValue(), 16, false);
+      } else if (auto *constFP = dyn_cast<ConstantFP>(V)) {
+        buffer += 'F' + toString(constFP->getValueAPF().bitcastToAPInt(), 16, false);
+      } else if (auto *global = dyn_cast<GlobalValue>(V)) {
+        buffer += 'G' + global->getName().str();
+      } else if (auto *constExpr = dyn_cast<ConstantExpr>(V)) {
+        buffer += 'E' + utostr(constExpr->getOpcode());
+        for (const Value *operand : constExpr->operands())
+          encodeOperand(operand, numbering, buffer);
+      } else {
+        buffer += 'C' + utostr(V->getValueID());
+        encodeType(V->getType(), buffer);
+      }
+      buffer += ',';
+    }
+
+    /**
+     * @brief Compute the key of a function in the persistent cache.
+     *
+     * The key hashes the module context (record version, DataLayout and the options that change
+     * the results), the function name and a structural encoding of its body: the CFG, opcodes,
+     * types, predicates, callees, constants, profile metadata and the def-use graph through local
+     * value numbers. StructuralHash on its own only looks at opcodes and operand counts, which is
+     * not enough to tell e.g. two memcpy lengths or two loop bounds apart.
+     *
+     * Only reads the IR, so it can run on the counting threads.
+     *
+     * @param F The LLVM function.
+     * @param context The encoded module context.
+     * @return The cache key.
+     */
+    static uint64_t getCacheKey(const Function &F, StringRef context) {
+      DenseMap<const Value *, unsigned> numbering;
+      for (const Argument &arg : F.args())
+        numbering[&arg] = numbering.size();
+      for (const BasicBlock &BB : F) {
+        numbering[&BB] = numbering.size();
+        for (const Instruction &I : BB)
+          numbering[&I] = numbering.size();
+      }
+
+      std::string buffer = context.str();
+      buffer += F.getName();
+      buffer += '\0';
+      encodeType(F.getFunctionType()->getReturnType(), buffer);
+      for (const Argument &arg : F.args())
+        encodeType(arg.getType(), buffer);
+      if (auto entryCount = F.getEntryCount())
+        buffer += 'P' + utostr(entryCount->getCount());
+
+      for (const BasicBlock &BB : F) {
+        buffer += 'B';
+        for (const Instruction &I : BB) {
+          buffer += utostr(I.getOpcode()) + '(';
+          encodeType(I.getType(), buffer);
+          if (auto *cmp = dyn_cast<CmpInst>(&I))
+            buffer += 'p' + utostr(cmp->getPredicate());
+          if (auto *alloca = dyn_cast<AllocaInst>(&I))
+            encodeType(alloca->getAllocatedType(), buffer);
+          if (auto *gep = dyn_cast<GetElementPtrInst>(&I))
+            encodeType(gep->getSourceElementType(), buffer);
+          for (const Value *operand : I.operands())
+            encodeOperand(operand, numbering, buffer);
+          if (const MDNode *prof = I.getMetadata(LLVMContext::MD_prof)) {
+            for (const MDOperand &weight : prof->operands())
+              if (auto *value = mdconst::dyn_extract_or_null<ConstantInt>(weight))
+                buffer += 'w' + utostr(value->getZExtValue());
+          }
+          buffer += ')';
+        }
+      }
+      return xxHash64(buffer);
+    }
+
+    /**
+     * @brief Call a function on every counter of a FunctionAnalysis stored in cache records.
+     *
+     * The COUNTER entries of memCheckMetrics.def, in order, whether their group is enabled or
+     * not. Uncached counters, e.g. the inclusive metrics, depend on the callees and are
+     * recomputed every run.
+     */
+    template <typename AnalysisT, typename FnT>
+    static void forEachCachedCounter(AnalysisT &analysis, FnT fn) {
+#define COUNTER(field, column, group) fn(analysis.field);
+#include "memCheckMetrics.def"
+    }
+
+    /**
+     * @brief Escape tabs, newlines and backslashes of a string stored in a cache record.
+     */
+    static std::string escapeCacheString(StringRef str) {
+      std::string escaped;
+      escaped.reserve(str.size());
+      for (char c : str) {
+        if (c == '\\')
+          escaped += "\\\\";
+        else if (c == '\t')
+          escaped += "\\t";
+        else if (c == '\n')
+          escaped += "\\n";
+        else
+          escaped += c;
+      }
+      return escaped;
+    }
+
+    /**
+     * @brief Undo escapeCacheString.
+     */
+    static std::string unescapeCacheString(StringRef str) {
+      std::string unescaped;
+      unescaped.reserve(str.size());
+      for (size_t i = 0; i < str.size(); ++i) {
+        if (str[i] == '\\' && i + 1 < str.size()) {
+          char c = str[++i];
+          unescaped += c == 't' ? '\t' : c == 'n' ? '\n' : c;
+        } else {
+          unescaped += str[i];
+        }
+      }
+      return unescaped;
+    }
+
+    /**
+     * @brief Append a cache record to a buffer.
+     *
+     * A record is a single line: version, key, payload fields and a checksum of everything before
+     * it, separated by tabs. Torn or interleaved lines fail the checksum and are ignored.
+     */
+    void writeCacheRecord(uint64_t key, const FunctionAnalysis &analysis, std::string &buffer) {
+      std::string record;
+      raw_string_ostream recordStream(record);
+      recordStream << cacheRecordVersion << '\t' << format_hex_no_prefix(key, 16)
+                   << '\t' << escapeCacheString(analysis.demangledName)
+                   << '\t' << escapeCacheString(analysis.dynBytesExpr)
+                   << '\t' << (analysis.isHot ? 1 : 0);
+      forEachCachedCounter(analysis, [&](uint64_t counter) { recordStream << '\t' << counter; });
+      recordStream.flush();
+      buffer += record;
+      buffer += '\t';
+      buffer += utohexstr(xxHash64(record) & 0xffffffff, /*LowerCase=*/true);
+      buffer += '\n';
+    }
+
+    /**
+     * @brief Parse a cache record written by writeCacheRecord.
+     * @return true if the record is well-formed and its checksum matches.
+     */
+    bool parseCacheRecord(StringRef line, uint64_t &key, FunctionAnalysis &analysis) {
+      size_t checksumStart = line.rfind('\t');
+      if (checksumStart == StringRef::npos)
+        return false;
+      StringRef record = line.take_front(checksumStart);
+      uint64_t checksum;
+      if (line.drop_front(checksumStart + 1).getAsInteger(16, checksum) ||
+          checksum != (xxHash64(record) & 0xffffffff))
+        return false;
+
+      SmallVector<StringRef, 32> fields;
+      record.split(fields, '\t');
+      size_t counters = 0;
+      forEachCachedCounter(analysis, [&](uint64_t) { ++counters; });
+      if (fields.size() != 5 + counters || fields[0] != cacheRecordVersion || fields[1].getAsInteger(16, key))
+        return false;
+
+      analysis.demangledName = unescapeCacheString(fields[2]);
+      analysis.dynBytesExpr = unescapeCacheString(fields[3]);
+      analysis.isHot = fields[4] == "1";
+      size_t field = 5;
+      bool isValid = true;
+      forEachCachedCounter(analysis, [&](auto &counter) {
+        uint64_t value;
+        isValid &= !fields[field++].getAsInteger(10, value);
+        counter = value;
+      });
+      return isValid;
+    }
+
+    /**
+     * @brief Open the cache shard of a module and load its records.
+     *
+     * The cache directory holds one append-only shard per module identifier. Concurrent compiler
+     * processes only ever append whole lines (see saveCache), so reading never needs a lock.
+     *
+     * @param M The LLVM module being analyzed.
+     */
+    void loadCache(Module &M) {
+      cache.clear();
+      cacheFileRecords = 0;
+      cacheFileName.clear();
+      if (CacheDir.empty())
+        return;
+
+      if (std::error_code EC = sys::fs::create_directories(CacheDir)) {
+        errs() << "Warning: cannot create the memcheck cache directory " << CacheDir << ": "
+               << EC.message() << "\n";
+        return;
+      }
+      SmallString<256> path(CacheDir);
+      /* Both ends of the pipeline see different IR, so they keep separate shards */
+      sys::path::append(path, utohexstr(xxHash64(M.getModuleIdentifier()), /*LowerCase=*/true) +
+                                  (stage == Stage::PreOptimization ? ".pre" : "") + ".memcheck-cache");
+      cacheFileName = std::string(path.str());
+
+      auto buffer = MemoryBuffer::getFile(cacheFileName, /*IsText=*/false, /*RequiresNullTerminator=*/false);
+      if (!buffer)
+        return;
+      SmallVector<StringRef, 0> lines;
+      (*buffer)->getBuffer().split(lines, '\n', -1, /*KeepEmpty=*/false);
+      for (StringRef line : lines) {
+        uint64_t key;
+        FunctionAnalysis analysis;
+        if (parseCacheRecord(line, key, analysis))
+          cache[key] = std::move(analysis);
+        ++cacheFileRecords;
+      }
+    }
+
+    /**
+     * @brief Encode the module context that is part of every cache key.
+     *
+     * Any option that changes the cached fields has to appear here: the metric groups marked as
+     * cache keys in memCheckMetrics.def, and the parameters of their metrics.
+     */
+    std::string getCacheContext(const Module &M) {
+      std::string context;
+      raw_string_ostream contextStream(context);
+      contextStream << cacheRecordVersion << '|' << M.getDataLayoutStr();
+#define METRIC_GROUP(group, isEnabled, isCacheKey)                                    \
+      if (isCacheKey)                                                                 \
+        contextStream << "|" #group "=" << (isMetricGroupEnabled(MetricGroup::group) ? 1 : 0);
+#include "memCheckMetrics.def"
+      contextStream << "|trip=" << DefaultTripCount
+                    << "|threads=" << (OpenMPAnalysis ? getOpenMPThreads() : 0)
+                    << "|line=" << (OpenMPAnalysis ? CacheLineSize.getValue() : 0) << '|';
+      return contextStream.str();
+    }
+
+    /**
+     * @brief Encode the parallel region membership of a function for its cache key.
+     *
+     * Its parallel and per-thread bytes and false sharing stores depend on whether a caller in
+     * the module forks it, and through which runtime, not only on its body. Only reads
+     * parallelRegions, so it can run on the counting threads.
+     *
+     * @param F The LLVM function.
+     * @return The function part of the cache context.
+     */
+    std::string getRegionCacheContext(const Function &F) const {
+      if (!OpenMPAnalysis)
+        return std::string();
+      auto region = parallelRegions.find(&F);
+      if (region == parallelRegions.end())
+        return "region=0|";
+      return region->second.hasThreadIdArgument ? "region=kmpc|" : "region=gomp|";
+    }
+
+    /**
+     * @brief Append the records of the newly analyzed functions to the cache shard.
+     *
+     * All new records go out in a single write to a file opened for appending, which keeps lines
+     * of concurrent writers intact. When most of the shard is stale (functions that have since
+     * changed), it is instead replaced by a compacted copy through an atomic rename; appends
+     * racing with the rename are lost, which only costs cache misses.
+     *
+     * @param functions The defined functions of the module.
+     * @param counted The static counts of each function, with their cache keys.
+     * @param analysisMap The analysis results of the module.
+     */
+    void saveCache(ArrayRef<Function *> functions, ArrayRef<CountedFunction> counted,
+                   const std::map<Function *, FunctionAnalysis> &analysisMap) {
+      if (cacheFileName.empty())
+        return;
+
+      std::string appended, compacted;
+      size_t used = 0;
+      for (size_t i = 0; i < functions.size(); ++i) {
+        auto it = analysisMap.find(functions[i]);
+        if (it == analysisMap.end())
+          continue;
+        ++used;
+        writeCacheRecord(counted[i].cacheKey, it->second, compacted);
+        if (!counted[i].isCached)
+          writeCacheRecord(counted[i].cacheKey, it->second, appended);
+      }
+
+      if (cacheFileRecords > 1024 && cacheFileRecords > 4 * used) {
+        int FD;
+        SmallString<256> tempPath;
+        if (!sys::fs::createUniqueFile(cacheFileName + ".tmp%%%%%%", FD, tempPath)) {
+          raw_fd_ostream tempFile(FD, /*shouldClose=*/true);
+          tempFile << compacted;
+          tempFile.close();
+          if (!tempFile.has_error() && !sys::fs::rename(tempPath, cacheFileName))
+            return;
+          sys::fs::remove(tempPath);
+        }
+      }
+
+      if (appended.empty())
+        return;
+      int FD;
+      if (std::error_code EC = sys::fs::openFileForWrite(cacheFileName, FD, sys::fs::CD_OpenAlways,
+                                                         sys::fs::OF_Append)) {
+        errs() << "Warning: cannot write the memcheck cache " << cacheFileName << ": " << EC.message() << "\n";
+        return;
+      }
+      raw_fd_ostream cacheFile(FD, /*shouldClose=*/true, /*unbuffered=*/true);
+      cacheFile << appended;
+    }
+
+    /**
+     * @brief Inclusive totals of a function while its call graph SCC is being solved.
+     */
+    struct InclusiveTotals {
+      uint64_t loads = 0;
+      uint64_t stores = 0;
+      uint64_t bytes = 0;
+
+      /* Add Weight times Other, saturating instead of overflowing */
+      void addWeighted(const InclusiveTotals &other, uint64_t weight) {
+        loads = SaturatingAdd(loads, SaturatingMultiply(other.loads, weight));
+        stores = SaturatingAdd(stores, SaturatingMultiply(other.stores, weight));
+        bytes = SaturatingAdd(bytes, SaturatingMultiply(other.bytes, weight));
+      }
+
+      bool operator==(const InclusiveTotals &other) const {
+        return loads == other.loads && stores == other.stores && bytes == other.bytes;
+      }
+    };
+
+    /**
+     * @brief A call from one function of an SCC to another function of the same SCC.
+     */
+    struct RecursiveCall {
+      Function *caller;
+      Function *callee;
+      uint64_t weight;
+    };
+
+    /**
+     * @brief Compute the weight of a call site.
+     *
+     * Every call site counts once; with -memcheck-loops it is multiplied by the trip counts of
+     * the loops around it. Call graph edges without a call instruction (callback edges) count once.
+     *
+     * @param call The call instruction, or nullptr.
+     * @param FAM The FunctionAnalysisManager.
+     * @return The weight of the call site.
+     */
+    uint64_t getCallSiteWeight(const Value *call, FunctionAnalysisManager &FAM) {
+      const auto *callInst = dyn_cast_or_null<Instruction>(call);
+      if (!callInst || !LoopWeighting)
+        return 1;
+      const BasicBlock *BB = callInst->getParent();
+      Function &caller = *const_cast<Function *>(BB->getParent());
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(caller);
+      return getLoopNestWeight(LI.getLoopFor(BB), FAM.getResult<ScalarEvolutionAnalysis>(caller));
+    }
+
+    /**
+     * @brief Whether every defined function is counted, not only the reported ones.
+     */
+    static bool needsAllFunctions() {
+      return InclusiveMetrics || SummaryMetadata;
+    }
+
+    /**
+     * @brief Record the summary of every defined function in the module, for memcheck-link.
+     *
+     * See memCheckReport.h for the format. The metrics are the self metrics that the inclusive
+     * roll-up starts from, loop weighted with -memcheck-loops, and each callee is weighted like
+     * a call graph edge (see getCallSiteWeight). Callees are kept by name, including
+     * declarations, so that the link step resolves calls across translation units. A summary
+     * already in the module is replaced.
+     *
+     * @param M The LLVM module being analyzed.
+     * @param functions The defined functions of the module.
+     * @param isUserDefined Whether each function is reported.
+     * @param analysisMap Results of the functions analyzed so far.
+     * @param FAM The FunctionAnalysisManager.
+     */
+    void writeSummaryMetadata(Module &M, ArrayRef<Function *> functions, const std::vector<char> &isUserDefined,
+                              std::map<Function *, FunctionAnalysis> &analysisMap, FunctionAnalysisManager &FAM) {
+      LLVMContext &context = M.getContext();
+      Type *int64Ty = Type::getInt64Ty(context);
+      auto getCounter = [&](uint64_t value) -> Metadata * {
+        return ConstantAsMetadata::get(ConstantInt::get(int64Ty, value));
+      };
+
+      if (NamedMDNode *previous = M.getNamedMetadata(MEMCHECK_SUMMARY_METADATA))
+        M.eraseNamedMetadata(previous);
+      NamedMDNode *summary = M.getOrInsertNamedMetadata(MEMCHECK_SUMMARY_METADATA);
+      for (size_t i = 0; i < functions.size(); ++i) {
+        Function &F = *functions[i];
+        const FunctionAnalysis &self = analyzeFunction(F, analysisMap, FAM);
+
+        /* One weight per callee, in order of the first call */
+        MapVector<Function *, uint64_t> callees;
+        for (Instruction &I : instructions(F)) {
+          auto *call = dyn_cast<CallBase>(&I);
+          Function *callee = call ? call->getCalledFunction() : nullptr;
+          if (!callee || callee->isIntrinsic())
+            continue;
+          uint64_t &weight = callees[callee];
+          weight = SaturatingAdd(weight, getCallSiteWeight(call, FAM));
+        }
+        SmallVector<Metadata *, 8> calls;
+        for (const auto &callee : callees) {
+          calls.push_back(MDString::get(context, callee.first->getName()));
+          calls.push_back(getCounter(callee.second));
+        }
+
+        Metadata *fields[] = {
+          MDString::get(context, F.getName()),
+          getCounter(LoopWeighting ? self.dynLoads : self.loads),
+          getCounter(LoopWeighting ? self.dynStores : self.stores),
+          getCounter(LoopWeighting ? self.dynBytes : self.bytes),
+          getCounter(isUserDefined[i] ? 1 : 0),
+          getCounter(F.hasLocalLinkage() ? 1 : 0),
+          MDTuple::get(context, calls),
+        };
+        summary->addOperand(MDTuple::get(context, fields));
+      }
+    }
+
+    /**
+     * @brief Compute the inclusive metrics of every defined function in a single bottom-up walk.
+     *
+     * SCCs are visited callees first, so the inclusive totals of every function called from
+     * outside the current SCC are already final. Functions of a recursive SCC are solved by
+     * iterating the call equations up to -memcheck-recursion-iterations times, which amounts to
+     * unrolling the recursion that many levels. Results are memoized in the analysis map.
+     *
+     * @param CG The call graph of the module.
+     * @param analysisMap Results of the functions analyzed so far.
+     * @param FAM The FunctionAnalysisManager.
+     */
+    void computeInclusiveMetrics(CallGraph &CG, std::map<Function *, FunctionAnalysis> &analysisMap,
+                                 FunctionAnalysisManager &FAM) {
+      DenseMap<const Function *, InclusiveTotals> inclusive;
+
+      for (scc_iterator<CallGraph *> SCCI = scc_begin(&CG); !SCCI.isAtEnd(); ++SCCI) {
+        const std::vector<CallGraphNode *> &SCC = *SCCI;
+
+        SmallPtrSet<const Function *, 8> members;
+        for (CallGraphNode *node : SCC) {
+          if (Function *F = node->getFunction())
+            if (!F->isDeclaration())
+              members.insert(F);
+        }
+        if (members.empty())
+          continue;
+
+        /* Self metrics plus the (final) contributions of callees outside of the SCC */
+        MapVector<Function *, InclusiveTotals> base;
+        SmallVector<RecursiveCall, 8> recursiveCalls;
+        for (CallGraphNode *node : SCC) {
+          Function *F = node->getFunction();
+          if (!F || F->isDeclaration())
+            continue;
+
+          const FunctionAnalysis &self = analyzeFunction(*F, analysisMap, FAM);
+          InclusiveTotals &totals = base[F];
+          if (LoopWeighting)
+            totals = {self.dynLoads, self.dynStores, self.dynBytes};
+          else
+            totals = {self.loads, self.stores, self.bytes};
+
+          for (const CallGraphNode::CallRecord &record : *node) {
+            Function *callee = record.second->getFunction();
+            if (!callee || callee->isDeclaration())
+              continue;
+            const Value *call = record.first ? static_cast<const Value *>(*record.first) : nullptr;
+            uint64_t weight = getCallSiteWeight(call, FAM);
+            if (members.count(callee))
+              recursiveCalls.push_back({F, callee, weight});
+            else
+              totals.addWeighted(inclusive.lookup(callee), weight);
+          }
+        }
+
+        for (auto &entry : base)
+          inclusive[entry.first] = entry.second;
+
+        /* Bounded fixed point for recursive SCCs */
+        for (unsigned iteration = 0; !recursiveCalls.empty() && iteration < RecursionIterations; ++iteration) {
+          DenseMap<const Function *, InclusiveTotals> next;
+          for (auto &entry : base)
+            next[entry.first] = entry.second;
+          for (const RecursiveCall &call : recursiveCalls)
+            next[call.caller].addWeighted(inclusive[call.callee], call.weight);
+
+          bool changed = false;
+          for (auto &entry : base) {
+            changed |= !(next[entry.first] == inclusive[entry.first]);
+            inclusive[entry.first] = next[entry.first];
+          }
+          if (!changed)
+            break;
+        }
+
+        /* Memoize the results */
+        for (auto &entry : base) {
+          FunctionAnalysis &analysis = analysisMap[entry.first];
+          const InclusiveTotals &totals = inclusive[entry.first];
+          analysis.inclLoads = totals.loads;
+          analysis.inclStores = totals.stores;
+          analysis.inclBytes = totals.bytes;
+        }
+      }
+    }
+
+    /**
+     * @brief Estimated working set of one loop of a function.
+     */
+    struct LoopFootprint {
+      std::string location;    /* file:line:column of the loop header, or the header block name */
+      unsigned depth = 0;      /* Loop depth, 1 for outermost loops */
+      uint64_t tripCount = 0;  /* Trip count estimate of the loop itself */
+      uint64_t bytes = 0;      /* Distinct bytes touched by one execution of the loop */
+      uint64_t lines = 0;      /* Distinct cache lines touched by one execution of the loop */
+      uint64_t flops = 0;      /* Floating-point operations of one execution of the loop */
+      uint64_t trafficBytes = 0; /* Bytes loaded and stored by one execution of the loop, repeated accesses included */
+    };
+
+    /**
+     * @brief Address range of the accesses of a loop that share a base pointer and start.
+     */
+    struct FootprintRegion {
+      int64_t low = std::numeric_limits<int64_t>::max();   /* Lowest offset from the base */
+      int64_t high = std::numeric_limits<int64_t>::min();  /* One past the highest offset */
+      uint64_t bytes = 0;  /* Bytes of all executions, an upper bound of the distinct bytes */
+      uint64_t lines = 0;  /* Lines of all executions, assuming none of them share a line */
+    };
+
+    /**
+     * @brief Get the cache level a footprint does not fit in.
+     * @param bytes The footprint in bytes.
+     * @return "LLC", "L2" or "L1" for the largest level exceeded, or an empty string if it fits in L1.
+     */
+    static StringRef getExceededCacheLevel(uint64_t bytes) {
+      if (bytes > uint64_t(LLCSize) * 1024)
+        return "LLC";
+      if (bytes > uint64_t(L2Size) * 1024)
+        return "L2";
+      if (bytes > uint64_t(L1Size) * 1024)
+        return "L1";
+      return "";
+    }
+
+    /**
+     * @brief Get the memory level that serves the accesses of a loop, and its bandwidth in the machine model.
+     * @param footprintBytes The footprint of the loop in bytes.
+     * @param bandwidth Set to the bandwidth of the level in GB/s.
+     * @return The smallest level the footprint fits in: "L1", "L2", "LLC" or "DRAM".
+     */
+    StringRef getBandwidthLevel(uint64_t footprintBytes, double &bandwidth) const {
+      StringRef exceeded = getExceededCacheLevel(footprintBytes);
+      if (exceeded.empty()) {
+        bandwidth = machineModel->l1Bandwidth;
+        return "L1";
+      }
+      if (exceeded == "L1") {
+        bandwidth = machineModel->l2Bandwidth;
+        return "L2";
+      }
+      if (exceeded == "L2") {
+        bandwidth = machineModel->llcBandwidth;
+        return "LLC";
+      }
+      bandwidth = machineModel->dramBandwidth;
+      return "DRAM";
+    }
+
+    /**
+     * @brief Split the constant offset off a loop-invariant start address.
+     *
+     * Constants are pulled out of additions and out of the start of outer-loop recurrences, so
+     * that a[i][j] and a[i][j + 1] share the start {0,+,8000}<outer> and end up in one region.
+     *
+     * @param start The start, replaced by its non-constant part (nullptr if it is a constant).
+     * @param SE The ScalarEvolution analysis of the function.
+     * @return The constant offset.
+     */
+    static int64_t splitConstantOffset(const SCEV *&start, ScalarEvolution &SE) {
+      if (auto *constant = dyn_cast<SCEVConstant>(start)) {
+        if (!constant->getAPInt().isSignedIntN(48))
+          return 0;
+        start = nullptr;
+        return constant->getAPInt().getSExtValue();
+      }
+      if (auto *add = dyn_cast<SCEVAddExpr>(start)) {
+        /* Constants are always the first operand of a SCEV addition */
+        auto *constant = dyn_cast<SCEVConstant>(add->getOperand(0));
+        if (!constant || !constant->getAPInt().isSignedIntN(48))
+          return 0;
+        start = SE.getMinusSCEV(start, constant);
+        return constant->getAPInt().getSExtValue();
+      }
+      if (auto *addRec = dyn_cast<SCEVAddRecExpr>(start)) {
+        if (!addRec->isAffine())
+          return 0;
+        const SCEV *recStart = addRec->getStart();
+        int64_t offset = splitConstantOffset(recStart, SE);
+        if (offset)
+          start = SE.getAddRecExpr(recStart ? recStart : SE.getZero(addRec->getType()),
+                                   addRec->getStepRecurrence(SE), addRec->getLoop(), SCEV::FlagAnyWrap);
+        return offset;
+      }
+      return 0;
+    }
+
+    /**
+     * @brief Estimate the distinct memory footprint of one execution of a loop, i.e. per iteration of its parent.
+     *
+     * The address of every access in the loop (subloops included) is split with ScalarEvolution
+     * into a base pointer, a start that is invariant in the loop, and the affine recurrences of
+     * the loop and its subloops. Walking the recurrences with the trip count estimates gives the
+     * address range of the access; accesses sharing a base and start are merged into one region.
+     * A region touches at most its range, and at most the bytes (lines) of all its executions:
+     * a[4 * i] touches a quarter of its range, but every line of it. Accesses whose address is not
+     * affine in the loop (indirect) are counted as if each execution touched its own line. The
+     * flops and bytes of all executions are totalled on the way, for the arithmetic intensity.
+     *
+     * @param L The loop.
+     * @param DL The DataLayout of the module.
+     * @param LI The LoopInfo analysis of the function.
+     * @param SE The ScalarEvolution analysis of the function.
+     * @return The footprint of the loop.
+     */
+    LoopFootprint computeLoopFootprint(const Loop *L, const DataLayout &DL, LoopInfo &LI, ScalarEvolution &SE) {
+      LoopFootprint footprint;
+      footprint.depth = L->getLoopDepth();
+      footprint.tripCount = getTripCount(L, SE).estimate;
+      if (const DebugLoc &loc = L->getStartLoc())
+        footprint.location = (loc->getFilename() + ":" + Twine(loc.getLine()) + ":" + Twine(loc.getCol())).str();
+      else
+        footprint.location = L->getHeader()->getName().str();
+
+      uint64_t lineSize = std::max(1u, CacheLineSize.getValue());
+      DenseMap<std::pair<const SCEV *, const SCEV *>, FootprintRegion> regions;
+      FunctionAnalysis scratch;
+      for (BasicBlock *BB : L->blocks()) {
+        /* Executions of the block per execution of L */
+        uint64_t executions = 1;
+        for (const Loop *inner = LI.getLoopFor(BB); inner != L->getParentLoop(); inner = inner->getParentLoop())
+          executions = SaturatingMultiply(executions, getTripCount(inner, SE).estimate);
+
+        for (Instruction &I : *BB) {
+          bool isDeferred = false;
+          AccessTotals counts = countInstruction(I, DL, scratch, isDeferred);
+          footprint.flops = SaturatingAdd(footprint.flops, SaturatingMultiply<uint64_t>(executions, counts.flops));
+          footprint.trafficBytes = SaturatingAdd(footprint.trafficBytes, SaturatingMultiply<uint64_t>(executions, counts.bytes));
+          Value *pointer;
+          if (!getAccessPointer(I, pointer))
+            continue;
+          uint64_t bytes = counts.bytes;
+          uint64_t accessBytes = SaturatingMultiply(executions, bytes);
+          uint64_t accessLines = SaturatingMultiply(executions, divideCeil(bytes, lineSize));
+
+          /* Split the address into base, loop-invariant start and the span of the recurrences */
+          const SCEV *start = nullptr;
+          const SCEV *base = nullptr;
+          int64_t low = 0, high = 0;
+          bool isAffine = pointer != nullptr;
+          if (isAffine) {
+            const SCEV *address = SE.getSCEV(pointer);
+            base = SE.getPointerBase(address);
+            start = SE.getMinusSCEV(address, base);
+            while (isAffine && !isa<SCEVCouldNotCompute>(start) && !SE.isLoopInvariant(start, L)) {
+              auto *addRec = dyn_cast<SCEVAddRecExpr>(start);
+              auto *step = addRec ? dyn_cast<SCEVConstant>(addRec->getStepRecurrence(SE)) : nullptr;
+              if (!step || !addRec->isAffine() || !L->contains(addRec->getLoop()) ||
+                  !step->getAPInt().isSignedIntN(32)) {
+                isAffine = false;
+                break;
+              }
+              int64_t stride = step->getAPInt().getSExtValue();
+              /* Clamped so that the offsets below can never overflow */
+              int64_t span = int64_t(std::min<uint64_t>(
+                  SaturatingMultiply<uint64_t>(std::abs(stride), getTripCount(addRec->getLoop(), SE).estimate - 1),
+                  uint64_t(1) << 48));
+              if (stride > 0)
+                high += span;
+              else
+                low -= span;
+              start = addRec->getStart();
+            }
+            isAffine &= !isa<SCEVCouldNotCompute>(start);
+          }
+          if (!isAffine) {
+            footprint.bytes = SaturatingAdd(footprint.bytes, accessBytes);
+            footprint.lines = SaturatingAdd(footprint.lines, accessLines);
+            continue;
+          }
+
+          /* Starts that only differ by a constant share a region, so a[i] and a[i + 1] overlap */
+          int64_t offset = splitConstantOffset(start, SE);
+          FootprintRegion &region = regions[{base, start}];
+          region.low = std::min(region.low, offset + low);
+          region.high = std::max(region.high, offset + high + int64_t(bytes));
+          region.bytes = SaturatingAdd(region.bytes, accessBytes);
+          region.lines = SaturatingAdd(region.lines, accessLines);
+        }
+      }
+
+      for (const auto &entry : regions) {
+        const FootprintRegion &region = entry.second;
+        uint64_t range = uint64_t(region.high - region.low);
+        footprint.bytes = SaturatingAdd(footprint.bytes, std::min(range, region.bytes));
+        footprint.lines = SaturatingAdd(footprint.lines, std::min(divideCeil(range, lineSize), region.lines));
+      }
+      return footprint;
+    }
+
+    /**
+     * @brief Write the footprint of every loop of a function to the loop report.
+     * @param F The LLVM function being analyzed.
+     * @param FAM The FunctionAnalysisManager, used to get LoopInfo and ScalarEvolution.
+     * @param loopsFile The loop report stream.
+     */
+    void writeLoopFootprints(Function &F, FunctionAnalysisManager &FAM, raw_ostream &loopsFile) {
+      LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+      if (LI.empty())
+        return;
+      ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+      std::string demangledName = demangle(F.getName().str());
+      for (const Loop *L : LI.getLoopsInPreorder()) {
+        LoopFootprint footprint = computeLoopFootprint(L, F.getParent()->getDataLayout(), LI, SE);
+        writeCSVCell(loopsFile, demangledName);
+        loopsFile << ',';
+        writeCSVCell(loopsFile, F.getName());
+        loopsFile << ',';
+        writeCSVCell(loopsFile, footprint.location);
+        loopsFile << ',' << footprint.depth
+                  << ',' << footprint.tripCount
+                  << ',' << footprint.bytes
+                  << ',' << footprint.lines
+                  << ',' << getExceededCacheLevel(footprint.bytes);
+        if (IntensityAnalysis) {
+          double bandwidth = 0;
+          StringRef level = machineModel ? getBandwidthLevel(footprint.bytes, bandwidth) : "";
+          RooflinePoint point = getRooflinePoint(footprint.flops, footprint.trafficBytes, bandwidth);
+          loopsFile << ',' << footprint.flops << ',' << footprint.trafficBytes << ',' << point.intensity;
+          if (machineModel)
+            loopsFile << ',' << level << ',' << (point.isMemoryBound ? "true" : "false")
+                      << ',' << point.attainableGFlops << ',' << point.memoryExcessTime;
+        }
+        loopsFile << '\n';
+      }
+    }
+
+    /**
+     * @brief Get the allocator called by a heap allocation call site.
+     *
+     * Besides the functions of isHeapAllocationFunction, posix_memalign and the allocate member of
+     * the standard allocators (recognized on the demangled name) count as allocations.
+     *
+     * @param call The call site.
+     * @return The demangled name of the allocator, or an empty string if the call does not allocate.
+     */
+    static std::string getHeapAllocator(const CallBase &call) {
+      Function *callee = call.getCalledFunction();
+      if (!callee)
+        return std::string();
+      StringRef name = callee->getName();
+      if (isHeapAllocationFunction(name) || name == "posix_memalign")
+        return demangle(name.str());
+      if (!name.startswith("_Z"))
+        return std::string();
+      std::string demangledName = demangle(name.str());
+      StringRef demangled(demangledName);
+      if (demangled.startswith("std::") && demangled.contains("allocator<") && demangled.contains("::allocate("))
+        return demangledName;
+      return std::string();
+    }
+
+    /**
+     * @brief Write the heap allocation call sites of a function to the allocation report.
+     *
+     * Each call site is weighted by the trip counts of its enclosing loops, which is how many
+     * times it runs per invocation of the function. Rows are sorted by that count, hottest first.
+     *
+     * @param F The LLVM function being analyzed.
+     * @param FAM The FunctionAnalysisManager.
+     * @param allocationsFile The allocation report stream.
+     */
+    void writeAllocationSites(Function &F, FunctionAnalysisManager &FAM, raw_ostream &allocationsFile) {
+      struct AllocationSite {
+        std::string location;
+        std::string allocator;
+        unsigned depth;
+        uint64_t executions;
+      };
+      SmallVector<AllocationSite, 8> sites;
+      LoopInfo *LI = nullptr;
+      ScalarEvolution *SE = nullptr;
+      for (BasicBlock &BB : F) {
+        for (Instruction &I : BB) {
+          auto *call = dyn_cast<CallBase>(&I);
+          if (!call)
+            continue;
+          std::string allocator = getHeapAllocator(*call);
+          if (allocator.empty())
+            continue;
+          if (!LI) {
+            LI = &FAM.getResult<LoopAnalysis>(F);
+            SE = &FAM.getResult<ScalarEvolutionAnalysis>(F);
+          }
+
+          AllocationSite &site = sites.emplace_back();
+          site.allocator = std::move(allocator);
+          site.depth = LI->getLoopDepth(&BB);
+          site.executions = 1;
+          for (const Loop *L = LI->getLoopFor(&BB); L; L = L->getParentLoop())
+            site.executions = SaturatingMultiply(site.executions, getTripCount(L, *SE).estimate);
+          if (const DebugLoc &loc = call->getDebugLoc())
+            site.location = (loc->getFilename() + ":" + Twine(loc.getLine()) + ":" + Twine(loc.getCol())).str();
+          else
+            site.location = BB.getName().str();
+        }
+      }
+
+      llvm::stable_sort(sites, [](const AllocationSite &a, const AllocationSite &b) {
+        return a.executions > b.executions;
+      });
+      std::string demangledName = demangle(F.getName().str());
+      for (const AllocationSite &site : sites) {
+        writeCSVCell(allocationsFile, demangledName);
+        allocationsFile << ',';
+        writeCSVCell(allocationsFile, F.getName());
+        allocationsFile << ',';
+        writeCSVCell(allocationsFile, site.location);
+        allocationsFile << ',';
+        writeCSVCell(allocationsFile, site.allocator);
+        allocationsFile << ',' << site.depth << ',' << site.executions << '\n';
+      }
+    }
+
+    /**
+     * @brief Write the potential false-sharing stores of a parallel region to the false-sharing report.
+     * @param F The LLVM function being analyzed.
+     * @param analysis The analysis results of the function.
+     * @param falseSharingFile The false-sharing report stream.
+     */
+    void writeFalseSharingHints(Function &F, const FunctionAnalysis &analysis, raw_ostream &falseSharingFile) {
+      auto region = parallelRegions.find(&F);
+      if (region == parallelRegions.end())
+        return;
+      SmallVector<FalseSharingHint, 4> hints;
+      findFalseSharingStores(F, region->second, hints);
+      for (const FalseSharingHint &hint : hints) {
+        writeCSVCell(falseSharingFile, analysis.demangledName);
+        falseSharingFile << ',';
+        writeCSVCell(falseSharingFile, F.getName());
+        falseSharingFile << ',';
+        writeCSVCell(falseSharingFile, analysis.parallelParent);
+        falseSharingFile << ',';
+        if (const DebugLoc &loc = hint.store->getDebugLoc())
+          writeCSVCell(falseSharingFile, (loc->getFilename() + ":" + Twine(loc.getLine()) + ":" + Twine(loc.getCol())).str());
+        else
+          writeCSVCell(falseSharingFile, hint.store->getParent()->getName());
+        falseSharingFile << ',' << hint.pattern << ',' << hint.distance << '\n';
+      }
+    }
+
+    /**
+     * @brief Attribute the outlined parallel regions to their enclosing source functions.
+     *
+     * Every region gets the first ancestor that is not itself a region as its parallel parent, and
+     * its bytes over all threads are added to the parallel region bytes of each of its ancestors.
+     *
+     * @param analysisMap The analysis results of the module.
+     */
+    void attributeParallelRegions(std::map<Function *, FunctionAnalysis> &analysisMap) {
+      for (auto &entry : analysisMap) {
+        auto region = parallelRegions.find(entry.first);
+        if (region == parallelRegions.end())
+          continue;
+        Function *parent = region->second.parent;
+        /* Bounded, fork calls could be recursive */
+        for (unsigned depth = 0; parent && depth < 16; ++depth) {
+          auto parentAnalysis = analysisMap.find(parent);
+          if (parentAnalysis != analysisMap.end())
+            parentAnalysis->second.parallelRegionBytes =
+                SaturatingAdd(parentAnalysis->second.parallelRegionBytes, entry.second.parallelBytes);
+          auto parentRegion = parallelRegions.find(parent);
+          if (parentRegion == parallelRegions.end())
+            break;
+          parent = parentRegion->second.parent;
+        }
+        entry.second.parallelParent = parent ? demangle(parent->getName().str()) : std::string();
+      }
+    }
+
+    /**
+     * @brief Get the weight of a block for the per-access reports.
+     * @param BB The basic block.
+     * @param BFI The BlockFrequencyInfo of its function if it has profile data and -memcheck-profile is on.
+     * @param FAM The FunctionAnalysisManager.
+     * @return The profile count of the block, else its loop nest weight with -memcheck-loops, else 1.
+     */
+    uint64_t getBlockWeight(BasicBlock &BB, BlockFrequencyInfo *BFI, FunctionAnalysisManager &FAM) {
+      if (BFI) {
+        auto count = BFI->getBlockProfileCount(&BB);
+        return count ? *count : 0;
+      }
+      if (LoopWeighting) {
+        Function &F = *BB.getParent();
+        return getLoopNestWeight(FAM.getResult<LoopAnalysis>(F).getLoopFor(&BB),
+                                 FAM.getResult<ScalarEvolutionAnalysis>(F));
+      }
+      return 1;
+    }
+
+    /**
+     * @brief Accesses to one field of a struct type, over all reported functions.
+     */
+    struct FieldAccesses {
+      uint64_t loads = 0;
+      uint64_t stores = 0;
+      uint64_t weighted = 0;  /* Loads and stores weighted by profile counts or loop nests */
+    };
+
+    /**
+     * @brief Add the struct field loads and stores of a function to the per-field totals.
+     *
+     * Accesses are weighted by their block profile count if the function has profile data
+     * (-memcheck-profile), else by the trip counts of their loop nest with -memcheck-loops, else 1.
+     *
+     * @param F The LLVM function being analyzed.
+     * @param FAM The FunctionAnalysisManager.
+     * @param fields The per-field totals, by struct type.
+     */
+    void collectFieldAccesses(Function &F, FunctionAnalysisManager &FAM,
+                              MapVector<StructType *, SmallVector<FieldAccesses, 8>> &fields) {
+      BlockFrequencyInfo *BFI = PSI && F.getEntryCount() ? &FAM.getResult<BlockFrequencyAnalysis>(F) : nullptr;
+      for (BasicBlock &BB : F) {
+        std::optional<uint64_t> weight;
+        for (Instruction &I : BB) {
+          Value *address = getLoadStorePointerOperand(&I);
+          StructType *structTy;
+          unsigned field;
+          if (!address || !getAccessedField(address, structTy, field))
+            continue;
+          if (!weight)
+            weight = getBlockWeight(BB, BFI, FAM);
+          SmallVector<FieldAccesses, 8> &structFields = fields[structTy];
+          structFields.resize(structTy->getNumElements());
+          (isa<LoadInst>(I) ? structFields[field].loads : structFields[field].stores)++;
+          structFields[field].weighted = SaturatingAdd(structFields[field].weighted, *weight);
+        }
+      }
+    }
+
+    /**
+     * @brief Write the per-field report of every accessed struct type.
+     *
+     * Besides the layout of each field, the report marks the hot fields, the hottest ones that
+     * together take 90% of the weighted accesses of their struct, and how many cache lines of an
+     * object aligned to a cache line they span: the lines a hot/cold split would keep.
+     *
+     * @param fields The per-field totals, by struct type.
+     * @param DL The DataLayout of the module.
+     * @param fieldsFile The field report stream.
+     */
+    void writeFieldReport(const MapVector<StructType *, SmallVector<FieldAccesses, 8>> &fields,
+                          const DataLayout &DL, raw_ostream &fieldsFile) {
+      uint64_t lineSize = std::max(1u, CacheLineSize.getValue());
+      for (const auto &entry : fields) {
+        StructType *structTy = entry.first;
+        const StructLayout *layout = DL.getStructLayout(structTy);
+        unsigned fieldCount = structTy->getNumElements();
+        auto getFieldSize = [&](unsigned field) {
+          return DL.getTypeStoreSize(structTy->getElementType(field)).getKnownMinValue();
+        };
+        auto getFieldLines = [&](unsigned field) {
+          uint64_t offset = layout->getElementOffset(field);
+          uint64_t end = offset + std::max<uint64_t>(getFieldSize(field), 1);
+          return std::make_pair(offset / lineSize, (end - 1) / lineSize);
+        };
+
+        /* Hottest fields first, until they cover 90% of the weighted accesses */
+        SmallVector<unsigned, 8> order;
+        uint64_t totalWeighted = 0;
+        for (unsigned field = 0; field < fieldCount; ++field) {
+          order.push_back(field);
+          totalWeighted = SaturatingAdd(totalWeighted, entry.second[field].weighted);
+        }
+        llvm::stable_sort(order, [&](unsigned a, unsigned b) {
+          return entry.second[a].weighted > entry.second[b].weighted;
+        });
+        SmallVector<bool, 8> isHot(fieldCount);
+        std::set<uint64_t> hotLines;
+        uint64_t covered = 0;
+        for (unsigned field : order) {
+          if (!entry.second[field].weighted || double(covered) >= 0.9 * double(totalWeighted))
+            break;
+          isHot[field] = true;
+          covered = SaturatingAdd(covered, entry.second[field].weighted);
+          auto lines = getFieldLines(field);
+          for (uint64_t line = lines.first; line <= lines.second; ++line)
+            hotLines.insert(line);
+        }
+
+        std::string typeName;
+        if (structTy->hasName()) {
+          typeName = structTy->getName().str();
+        } else {
+          raw_string_ostream typeStream(typeName);
+          structTy->print(typeStream);
+        }
+        for (unsigned field = 0; field < fieldCount; ++field) {
+          uint64_t offset = layout->getElementOffset(field);
+          uint64_t next = field + 1 < fieldCount ? layout->getElementOffset(field + 1)
+                                                 : layout->getSizeInBytes();
+          auto lines = getFieldLines(field);
+          const FieldAccesses &accesses = entry.second[field];
+          writeCSVCell(fieldsFile, typeName);
+          fieldsFile << ',' << layout->getSizeInBytes()
+                     << ',' << field
+                     << ',' << offset
+                     << ',' << getFieldSize(field)
+                     << ',' << (next > offset + getFieldSize(field) ? next - offset - getFieldSize(field) : 0)
+                     << ',' << accesses.loads
+                     << ',' << accesses.stores
+                     << ',' << accesses.weighted
+                     << ',' << (lines.second - lines.first + 1)
+                     << ',' << (isHot[field] ? "true" : "false")
+                     << ',' << hotLines.size() << '\n';
+        }
+      }
+    }
+
+    /**
+     * @brief Write the redundant loads and dead stores of a function to the redundancy report, per source line.
+     *
+     * Uses the accesses found by finishFunction; only functions taken from the cache, whose
+     * analysis has no per-access results, are searched here.
+     *
+     * @param F The LLVM function being analyzed.
+     * @param FAM The FunctionAnalysisManager.
+     * @param redundancyFile The redundancy report stream.
+     */
+    void writeAvoidableAccesses(Function &F, FunctionAnalysisManager &FAM, raw_ostream &redundancyFile) {
+      auto found = avoidableAccesses.find(&F);
+      if (found == avoidableAccesses.end()) {
+        found = avoidableAccesses.try_emplace(&F).first;
+        findAvoidableAccesses(F, FAM, found->second);
+      }
+      const SmallVector<AvoidableAccess, 8> &avoidable = found->second;
+      if (avoidable.empty())
+        return;
+
+      /* Totals per line, keyed like the line report (see collectLineAccesses), in source order */
+      std::map<std::tuple<std::string, unsigned, unsigned>, FunctionAnalysis> lines;
+      for (const AvoidableAccess &access : avoidable) {
+        const DILocation *loc = access.I->getDebugLoc().get();
+        FunctionAnalysis &line = lines[loc ? std::make_tuple(getLocationPath(loc), loc->getLine(), loc->getColumn())
+                                           : std::make_tuple(std::string(unknownLocation), 0u, 0u)];
+        if (access.isDeadStore) {
+          line.deadStores++;
+          line.deadStoreBytes += access.bytes;
+        } else {
+          line.redundantLoads++;
+          line.redundantLoadBytes += access.bytes;
+        }
+      }
+
+      std::string demangledName = demangle(F.getName().str());
+      for (const auto &line : lines) {
+        writeCSVCell(redundancyFile, demangledName);
+        redundancyFile << ',';
+        writeCSVCell(redundancyFile, F.getName());
+        redundancyFile << ',';
+        const std::string &path = std::get<0>(line.first);
+        writeCSVCell(redundancyFile, path == unknownLocation ? path
+                                                             : path + ":" + utostr(std::get<1>(line.first)) + ":" +
+                                                                   utostr(std::get<2>(line.first)));
+        redundancyFile << ',' << line.second.redundantLoads
+                       << ',' << line.second.redundantLoadBytes
+                       << ',' << line.second.deadStores
+                       << ',' << line.second.deadStoreBytes << '\n';
+      }
+    }
+
+    /**
+     * @brief Accesses of one source line, over all reported functions.
+     */
+    struct LineAccesses {
+      const Instruction *first = nullptr;  /* First access of the line, which locates its remark */
+      AccessTotals counts;
+      uint64_t weightedLoads = 0;   /* Weighted like the field report (see getBlockWeight) */
+      uint64_t weightedStores = 0;
+      uint64_t weightedBytes = 0;
+    };
+
+    /* Per-line totals keyed by source path, line and column, in source order */
+    using LineMap = std::map<std::tuple<std::string, unsigned, unsigned>, LineAccesses>;
+
+    /* The source path of the LineMap entry of accesses without a debug location */
+    static constexpr const char *unknownLocation = "<unknown>";
+
+    /**
+     * @brief Get the source path of a debug location: its file, under its directory unless absolute.
+     *
+     * Files of the same name in different directories are different lines.
+     */
+    static std::string getLocationPath(const DILocation *loc) {
+      SmallString<256> path;
+      if (!sys::path::is_absolute(loc->getFilename()))
+        path = loc->getDirectory();
+      sys::path::append(path, loc->getFilename());
+      sys::path::remove_dots(path, /*remove_dot_dot=*/true);
+      return std::string(path.str());
+    }
+
+    /**
+     * @brief Get the flame graph frame of a debug location: its function and file:line:column.
+     */
+    static std::string getLocationFrame(const DILocation *loc) {
+      const DISubprogram *subprog = loc->getScope()->getSubprogram();
+      std::string frame = !subprog                            ? std::string("<unknown>")
+                          : !subprog->getLinkageName().empty() ? demangle(subprog->getLinkageName().str())
+                                                               : subprog->getName().str();
+      raw_string_ostream(frame) << ' ' << loc->getFilename() << ':' << loc->getLine() << ':' << loc->getColumn();
+      /* Semicolons separate the frames of a folded stack */
+      std::replace(frame.begin(), frame.end(), ';', ':');
+      return frame;
+    }
+
+    /**
+     * @brief Add the memory traffic of a function to the per-line and per-stack totals.
+     *
+     * Every access goes to the source line it was written on: code inlined from another function
+     * counts for the line in the callee, wherever it was inlined. The stack of the access, from
+     * the line in the function it is in down through the inlined-at chain of its location, keeps
+     * the callers for the flame graph. Accesses without a debug location go to the single
+     * unknownLocation entry, over all functions.
+     *
+     * @param F The LLVM function being analyzed.
+     * @param FAM The FunctionAnalysisManager.
+     * @param lines The per-line totals.
+     * @param stacks The weighted bytes of each folded stack.
+     */
+    void collectLineAccesses(Function &F, FunctionAnalysisManager &FAM, LineMap &lines,
+                             std::map<std::string, uint64_t> &stacks) {
+      const DataLayout &DL = F.getParent()->getDataLayout();
+      BlockFrequencyInfo *BFI = PSI && F.getEntryCount() ? &FAM.getResult<BlockFrequencyAnalysis>(F) : nullptr;
+      std::string functionFrame = demangle(F.getName().str());
+      std::replace(functionFrame.begin(), functionFrame.end(), ';', ':');
+      for (BasicBlock &BB : F) {
+        std::optional<uint64_t> weight;
+        for (Instruction &I : BB) {
+          FunctionAnalysis scratch;
+          bool isDeferred = false;
+          AccessTotals counts = countInstruction(I, DL, scratch, isDeferred);
+          if (isDeferred) {
+            ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+            auto *memIntrinsic = cast<AnyMemIntrinsic>(&I);
+            if (auto *length = dyn_cast<SCEVConstant>(SE.getSCEV(memIntrinsic->getLength())))
+              counts.bytes = getMemIntrinsicBytes(memIntrinsic, length->getAPInt().getLimitedValue());
+          }
+          if (!counts.bytes)
+            continue;
+          if (!weight)
+            weight = getBlockWeight(BB, BFI, FAM);
+
+          const DILocation *loc = I.getDebugLoc().get();
+          LineAccesses &line = lines[loc ? std::make_tuple(getLocationPath(loc), loc->getLine(), loc->getColumn())
+                                         : std::make_tuple(std::string(unknownLocation), 0u, 0u)];
+          if (!line.first)
+            line.first = &I;
+          line.counts.add(counts);
+          line.weightedLoads = SaturatingAdd(line.weightedLoads, SaturatingMultiply<uint64_t>(counts.loads, *weight));
+          line.weightedStores = SaturatingAdd(line.weightedStores, SaturatingMultiply<uint64_t>(counts.stores, *weight));
+          line.weightedBytes = SaturatingAdd(line.weightedBytes, SaturatingMultiply<uint64_t>(counts.bytes, *weight));
+
+          /* Outermost frame first, i.e. the call sites in the function, then every inlined call down to the access */
+          SmallVector<const DILocation *, 4> chain;
+          for (const DILocation *frame = loc; frame; frame = frame->getInlinedAt())
+            chain.push_back(frame);
+          std::string stack;
+          for (const DILocation *frame : llvm::reverse(chain))
+            stack += (stack.empty() ? "" : ";") + getLocationFrame(frame);
+          if (stack.empty())
+            stack = functionFrame;
+          uint64_t &stackBytes = stacks[stack];
+          stackBytes = SaturatingAdd(stackBytes, SaturatingMultiply<uint64_t>(counts.bytes, *weight));
+        }
+      }
+    }
+
+    /**
+     * @brief Determines if a function is user-defined based on its source file (see UserCodeFilter).
+     *
+     * Functions without debug information are never user-defined. Not thread-safe, the decisions
+     * of the filter are cached.
+     *
+     * @param F A reference to the LLVM function to be checked.
+     * @return true if the function is user-defined, false otherwise.
+     */
+    bool isUserDefinedFunction(const Function &F) {
+      const DISubprogram *subprog = F.getSubprogram();
+      return subprog && subprog->getFile() && userCodeFilter.isUserFile(subprog->getFile());
+    }
+
+    /**
+     * @brief Write the per-function traffic removed or added by the optimizer.
+     *
+     * Functions are joined by mangled name: a function of the snapshot only is reported as
+     * removed (inlined everywhere or dead), a function of the optimized module only as added
+     * (e.g. a specialized clone). Changes are after minus before, so removed traffic is negative.
+     *
+     * @param before The reported functions of the pre-optimization run.
+     * @param after The reported functions of the post-optimization run.
+     * @param diffFile The diff report stream.
+     * @param bytesBefore Total bytes before optimization.
+     * @param bytesAfter Total bytes after optimization.
+     */
+    void writeOptimizationDiff(const OptimizationSnapshot &before, ArrayRef<const FunctionAnalysis *> after,
+                               raw_ostream &diffFile, uint64_t &bytesBefore, uint64_t &bytesAfter) {
+      diffFile << "'Function Name (Demangled)','Function Name (Mangled)','Status','Loads Before','Loads After'"
+               << ",'Stores Before','Stores After','Bytes Before','Bytes After','Bytes Change'";
+      if (LoopWeighting)
+        diffFile << ",'Dynamic Bytes Before','Dynamic Bytes After','Dynamic Bytes Change'";
+      diffFile << " \n";
+
+      auto writeChange = [&](uint64_t oldValue, uint64_t newValue) {
+        if (newValue >= oldValue)
+          diffFile << newValue - oldValue;
+        else
+          diffFile << '-' << oldValue - newValue;
+      };
+      const FunctionAnalysis none;
+      auto writeRow = [&](const FunctionAnalysis *oldAnalysis, const FunctionAnalysis *newAnalysis) {
+        const FunctionAnalysis &names = newAnalysis ? *newAnalysis : *oldAnalysis;
+        const FunctionAnalysis &oldValues = oldAnalysis ? *oldAnalysis : none;
+        const FunctionAnalysis &newValues = newAnalysis ? *newAnalysis : none;
+        writeCSVCell(diffFile, names.demangledName);
+        diffFile << ',';
+        writeCSVCell(diffFile, names.mangledName);
+        diffFile << ',' << (!newAnalysis ? "removed" : !oldAnalysis ? "added" : "kept")
+                 << ',' << oldValues.loads << ',' << newValues.loads
+                 << ',' << oldValues.stores << ',' << newValues.stores
+                 << ',' << oldValues.bytes << ',' << newValues.bytes << ',';
+        writeChange(oldValues.bytes, newValues.bytes);
+        if (LoopWeighting) {
+          diffFile << ',' << oldValues.dynBytes << ',' << newValues.dynBytes << ',';
+          writeChange(oldValues.dynBytes, newValues.dynBytes);
+        }
+        diffFile << '\n';
+        bytesBefore = SaturatingAdd<uint64_t>(bytesBefore, oldValues.bytes);
+        bytesAfter = SaturatingAdd<uint64_t>(bytesAfter, newValues.bytes);
+      };
+
+      /* Functions of the snapshot in its order, then the added ones in module order */
+      StringMap<const FunctionAnalysis *> newAnalyses;
+      for (const FunctionAnalysis *analysis : after)
+        newAnalyses.try_emplace(analysis->mangledName, analysis);
+      StringMap<bool> oldNames;
+      for (const FunctionAnalysis &oldAnalysis : before.functions) {
+        oldNames.try_emplace(oldAnalysis.mangledName, true);
+        auto newAnalysis = newAnalyses.find(oldAnalysis.mangledName);
+        writeRow(&oldAnalysis, newAnalysis == newAnalyses.end() ? nullptr : newAnalysis->second);
+      }
+      for (const FunctionAnalysis *analysis : after) {
+        if (!oldNames.count(analysis->mangledName))
+          writeRow(nullptr, analysis);
+      }
+    }
+
+    /**
+     * @brief A column of the reports: its name and how to get its value from a FunctionAnalysis.
+     */
+    struct ReportColumn {
+      enum Kind { Counter, String, Flag };
+      StringRef name;
+      Kind kind;
+      uint64_t (*counter)(const FunctionAnalysis &) = nullptr;  /* Counter and Flag columns */
+      StringRef (*string)(const FunctionAnalysis &) = nullptr;  /* String columns */
+      StringRef (*marker)(const FunctionAnalysis &) = nullptr;  /* Optional suffix of the console output */
+
+      ReportColumn withMarker(StringRef (*marker)(const FunctionAnalysis &)) const {
+        ReportColumn column = *this;
+        column.marker = marker;
+        return column;
+      }
+    };
+
+    static ReportColumn counterColumn(StringRef name, uint64_t (*counter)(const FunctionAnalysis &)) {
+      return {name, ReportColumn::Counter, counter, nullptr};
+    }
+
+    static ReportColumn flagColumn(StringRef name, uint64_t (*flag)(const FunctionAnalysis &)) {
+      return {name, ReportColumn::Flag, flag, nullptr};
+    }
+
+    static ReportColumn stringColumn(StringRef name, StringRef (*string)(const FunctionAnalysis &)) {
+      return {name, ReportColumn::String, nullptr, string};
+    }
 
-#include <fstream>
-#include <string>
-#include <sstream>
-#include <cstdlib>
+    /**
+     * @brief Determines if the metrics of a group are counted and reported in this run.
+     *
+     * Only reads options and the per-run state, so it can run on the counting threads.
+     */
+    bool isMetricGroupEnabled(MetricGroup metricGroup) const {
+      switch (metricGroup) {
+#define METRIC_GROUP(group, isEnabled, isCacheKey) \
+        case MetricGroup::group:                   \
+          return isEnabled;
+#include "memCheckMetrics.def"
+      }
+      llvm_unreachable("unknown metric group");
+    }
 
-using namespace llvm;
+    /**
+     * @brief Get the share of the load and store bytes moved by vector instructions, in percent.
+     *
+     * Memory intrinsics and atomics are excluded.
+     */
+    static uint64_t getVectorBytesShare(const FunctionAnalysis &a) {
+      uint64_t accessBytes = a.bytes - a.memIntrinsicBytes - a.atomicBytes;
+      return accessBytes ? a.vectorBytes * 100 / accessBytes : 0;
+    }
 
-namespace {
-  /**
-   * @brief Pass for static function analysis.
-   */
-  class memcheck : public PassInfoMixin<memcheck> {
-  private:
     /**
-     * @brief Struct to store analysis results for a function.
+     * @brief Get the columns of the reports for the enabled analysis modes.
+     *
+     * The columns of the enabled groups of memCheckMetrics.def, in its order. All writers
+     * iterate this list, so every output has the same columns in the same order. The first two
+     * columns are always the demangled and the mangled name.
+     *
+     * @return The report columns.
      */
-    struct FunctionAnalysis {
-      std::string mangledName;    /* Mangled function name */
-      std::string demangledName;  /* Demangled function name */
-      size_t loads = 0;           /* Loads */
-      size_t stores = 0;          /* Stores */
-      size_t bytes = 0;           /* Bytes */
-    };
+    std::vector<ReportColumn> getReportColumns() {
+      std::vector<ReportColumn> columns;
+#define COUNTER(field, column, group)                                                                       \
+      if (*column && isMetricGroupEnabled(MetricGroup::group))                                              \
+        columns.push_back(counterColumn(column, [](const FunctionAnalysis &a) -> uint64_t { return a.field; }));
+#define UNCACHED_COUNTER(field, column, group) COUNTER(field, column, group)
+#define DERIVED(column, group, value)                                                                       \
+      if (isMetricGroupEnabled(MetricGroup::group))                                                         \
+        columns.push_back(counterColumn(column, [](const FunctionAnalysis &a) -> uint64_t { return value; }));
+#define FLAG(column, group, value)                                                                          \
+      if (isMetricGroupEnabled(MetricGroup::group))                                                         \
+        columns.push_back(flagColumn(column, [](const FunctionAnalysis &a) -> uint64_t { return value; }));
+#define STRING(column, group, value)                                                                        \
+      if (isMetricGroupEnabled(MetricGroup::group))                                                         \
+        columns.push_back(stringColumn(column, [](const FunctionAnalysis &a) { return StringRef(value); }));
+#define MARKER(group, value)                                                                                \
+      if (isMetricGroupEnabled(MetricGroup::group))                                                         \
+        columns.back() = columns.back().withMarker([](const FunctionAnalysis &a) { return StringRef(value); });
+#include "memCheckMetrics.def"
+      return columns;
+    }
 
-    std::set<const Function *> visitedFunctions;
-    
-    // Output files names
-    std::string csvFileName = "static_function_analysis.csv";
-    std::string jsonFileName = "static_function_analysis.json";
+    /**
+     * @brief Get the report column of the most precise estimate of the bytes of a function.
+     *
+     * Profile bytes if the module has a profile, loop weighted bytes with -memcheck-loops, else
+     * the straight-line bytes; getEstimatedBytes returns its value.
+     */
+    StringRef getEstimatedBytesColumn() const {
+      return PSI ? "Profile Bytes" : LoopWeighting ? "Dynamic Bytes" : "Bytes";
+    }
+
+    uint64_t getEstimatedBytes(const FunctionAnalysis &analysis) const {
+      return PSI ? analysis.profBytes : LoopWeighting ? analysis.dynBytes : uint64_t(analysis.bytes);
+    }
 
     /**
-     * @brief Analyze a function and compute its metrics.
-     * @param F The LLVM function to analyze.
-     * @return A FunctionAnalysis struct containing the analysis results.
+     * @brief Print the module summary: the totals and percentiles of the summary metrics over the
+     *        reported functions, and the top functions by each of them.
+     * @param OS The stream to print to, normally a buffered standard error.
+     * @param M The LLVM module being analyzed.
+     * @param reported The reported functions.
+     * @param columns The report columns.
      */
-    FunctionAnalysis analyzeFunction(Function &F, std::map<Function *, FunctionAnalysis> &analysisMap) {
-      /* Check if the function has already been analyzed */
-      auto it = analysisMap.find(&F);
-      if (it != analysisMap.end()) {
-        /* If the function has already been analyzed, return the stored results */
-        return it->second;
+    void printModuleSummary(raw_ostream &OS, const Module &M, ArrayRef<const FunctionAnalysis *> reported,
+                            ArrayRef<ReportColumn> columns) {
+      SmallVector<StringRef, 8> metricNames(TopMetrics.begin(), TopMetrics.end());
+      if (metricNames.empty()) {
+        metricNames = {"Loads", "Stores", "Bytes"};
+        if (LoopWeighting)
+          metricNames.push_back("Dynamic Bytes");
+        if (PSI)
+          metricNames.push_back("Profile Bytes");
       }
 
-      FunctionAnalysis result;
-      result.mangledName = F.getName().str();
-      result.demangledName = demangle(result.mangledName);
+      OS << "-------------------------------------------\n"
+         << " Module Summary: " << M.getModuleIdentifier() << " (" << reported.size() << " functions)\n"
+         << "-------------------------------------------\n";
+      std::vector<const FunctionAnalysis *> ranked(reported.begin(), reported.end());
+      for (StringRef name : metricNames) {
+        const ReportColumn *column = llvm::find_if(columns, [&](const ReportColumn &column) {
+          return column.name == name && column.kind == ReportColumn::Counter;
+        });
+        if (column == columns.end()) {
+          errs() << "Warning: -memcheck-top-by column '" << name << "' is not a counter column of the report, ignored.\n";
+          continue;
+        }
 
-      for (auto &BB : F) {
-        for (auto &I : BB) {
-          /* Check if the instruction is a load */
-          if (auto *load = dyn_cast<LoadInst>(&I)) {
-            result.loads++;
-            result.bytes += F.getParent()->getDataLayout().getTypeAllocSize(load->getType());
-          }
-          /* Check if the instruction is a store */
-          else if (auto *store = dyn_cast<StoreInst>(&I)) {
-            result.stores++;
-            result.bytes += F.getParent()->getDataLayout().getTypeAllocSize(store->getValueOperand()->getType());
-          }
+        std::stable_sort(ranked.begin(), ranked.end(), [&](const FunctionAnalysis *a, const FunctionAnalysis *b) {
+          return column->counter(*a) > column->counter(*b);
+        });
+        uint64_t total = 0;
+        for (const FunctionAnalysis *analysis : ranked)
+          total = SaturatingAdd(total, column->counter(*analysis));
+        /* Nearest rank percentiles of the per-function values */
+        auto getPercentile = [&](unsigned percent) -> uint64_t {
+          if (ranked.empty())
+            return 0;
+          size_t rank = divideCeil(ranked.size() * percent, 100);
+          return column->counter(*ranked[ranked.size() - std::max<size_t>(rank, 1)]);
+        };
+        OS << "  '" << name << "': total " << total << ", p50 " << getPercentile(50) << ", p90 "
+           << getPercentile(90) << ", p99 " << getPercentile(99) << ", max " << getPercentile(100) << "\n";
+        for (size_t i = 0; i < ranked.size() && i < TopCount; ++i) {
+          uint64_t value = column->counter(*ranked[i]);
+          OS << "    " << right_justify(std::to_string(i + 1), 3) << ". " << value << " ("
+             << format("%.1f", total ? 100.0 * value / total : 0.0) << "%) " << ranked[i]->demangledName << "\n";
         }
       }
-      /* Store the analysis results in the map */
-      analysisMap[&F] = result;
+      OS << "-------------------------------------------\n\n";
+    }
 
-      return result;
+    /**
+     * @brief Read the report of -memcheck-baseline, once.
+     * @return Whether the baseline is available.
+     */
+    bool loadBaseline() {
+      if (isBaselineLoaded)
+        return baselineBuffer != nullptr;
+      isBaselineLoaded = true;
+      auto file = MemoryBuffer::getFile(BaselineReport);
+      if (!file) {
+        errs() << "Error: cannot read " << BaselineReport << ": " << file.getError().message() << "\n";
+        return false;
+      }
+      line_iterator line(**file, /*SkipBlanks=*/true);
+      if (line.is_at_eof()) {
+        errs() << "Error: " << BaselineReport << " is empty\n";
+        return false;
+      }
+      baselineHeader = *line;
+      /* The first row of a name wins, like memcheck-merge */
+      for (++line; !line.is_at_eof(); ++line)
+        baselineRows.try_emplace(memcheckReport::unquoteCSV(memcheckReport::getCSVField(*line, memcheckReport::mangledNameColumn)), *line);
+      baselineBuffer = std::move(*file);
+      return true;
     }
 
     /**
-     * @brief Determines if a function is user-defined based on its file path.
+     * @brief Diagnose the reported functions whose estimated bytes grew beyond the threshold over the baseline.
      *
-     * This function checks whether the given LLVM function is user-defined by examining the debug
-     * information associated with the function. If the function's source file path starts with the
-     * specified project root path, it is considered user-defined.
-     * 
-     * @param F A reference to the LLVM function to be checked.
-     * @return true if the function is user-defined, false otherwise.
+     * Functions missing from the baseline are new and never regressions. Each regression is a
+     * warning; with -memcheck-regression-error, a final error makes the compilation fail, after
+     * all of them have been reported.
      *
-     * @note This function relies on the presence of debug information in the LLVM IR. If the debug
-     *       information is missing or if the function's source file is not within the project root
-     *       directory, the function will be considered not user-defined.
+     * @param M The LLVM module being analyzed.
+     * @param reported The reported functions.
      */
-    bool isUserDefinedFunction( const Function &F ) {
-      /* Retrieve the project root path from the $SCOP_ROOT environment variable */
-      const char* projectRoot = std::getenv("SCOP_ROOT");
-      /* If the $SCOP_ROOT environment variable is not set, return false */
-      if (!projectRoot) {
-        errs() << "Error: $SCOP_ROOT environment variable is not set.\n";
-        return false;
+    void checkBaseline(Module &M, ArrayRef<const FunctionAnalysis *> reported) {
+      if (!loadBaseline())
+        return;
+      StringRef columnName = getEstimatedBytesColumn();
+      int column = memcheckReport::findCSVColumn(baselineHeader, columnName);
+      if (column < 0) {
+        errs() << "Error: baseline " << BaselineReport << " has no column '" << columnName << "'\n";
+        return;
       }
 
-      /* Check if the function has debug information */
-      if (const DISubprogram *subprog = F.getSubprogram()) {
-        /* Get the file where the function is defined */
-        const DIFile *file = subprog->getFile();
+      size_t regressions = 0;
+      for (const FunctionAnalysis *analysis : reported) {
+        auto row = baselineRows.find(analysis->mangledName);
+        if (row == baselineRows.end())
+          continue;
+        uint64_t before = 0;
+        if (memcheckReport::getCSVField(row->second, column).trim().getAsInteger(10, before))
+          continue;
+        uint64_t after = getEstimatedBytes(*analysis);
+        if (after <= before || after - before < RegressionMinBytes ||
+            (before && 100.0 * (after - before) / before <= RegressionThreshold))
+          continue;
+
+        ++regressions;
+        std::string message;
+        raw_string_ostream messageStream(message);
+        messageStream << "memcheck: '" << columnName << "' of " << analysis->demangledName << " grew from "
+                      << before << " to " << after;
+        if (before)
+          messageStream << " (+" << format("%.1f", 100.0 * (after - before) / before) << "%)";
+        messageStream << ", over the " << format("%.1f", double(RegressionThreshold)) << "% threshold of baseline "
+                      << BaselineReport;
+        M.getContext().diagnose(MemcheckDiagnostic(messageStream.str(), DS_Warning));
+      }
 
-        if (file) {
-          /* Get the directory and file path */
-          std::string dir = file->getDirectory().str();
-          std::string filePath = file->getFilename().str();
+      if (regressions && RegressionErrors) {
+        std::string message = ("memcheck: " + M.getModuleIdentifier() + ": " + Twine(regressions) +
+                               " function(s) regressed over baseline " + BaselineReport).str();
+        M.getContext().diagnose(MemcheckDiagnostic(message, DS_Error));
+      }
+    }
 
-          /* Construct the full path to the file */
-          llvm::SmallString<256> fullPath(dir);
-          llvm::sys::path::append(fullPath, filePath); // Corrected namespace
+    /**
+     * @brief Print the module summary and check the baseline, as enabled, once all reports are written.
+     * @param M The LLVM module being analyzed.
+     * @param reported The reported functions.
+     * @param columns The report columns.
+     */
+    void summarizeModule(Module &M, ArrayRef<const FunctionAnalysis *> reported, ArrayRef<ReportColumn> columns) {
+      if (TopCount) {
+        raw_fd_ostream console(2, /*shouldClose=*/false);
+        printModuleSummary(console, M, reported, columns);
+      }
+      /* The baseline holds optimized code, a pre-optimization run has nothing to compare */
+      if (!BaselineReport.empty() && stage != Stage::PreOptimization)
+        checkBaseline(M, reported);
+    }
 
-          /* Check if the full path starts with the project root */
-          return fullPath.str().startswith(projectRoot);
+    /**
+     * @brief Print the analysis results of a function.
+     * @param OS The stream to print to, normally a buffered standard error.
+     * @param analysis The analysis results for the function.
+     * @param columns The report columns.
+     */
+    void printFunctionAnalysis(raw_ostream &OS, const FunctionAnalysis &analysis, ArrayRef<ReportColumn> columns) {
+      OS << "-------------------------------------------\n"
+         << " Function Name (Demangled): " << analysis.demangledName << "\n"
+         << " Function Name (Mangled): " << analysis.mangledName << "\n"
+         << "-------------------------------------------\n";
+      for (const ReportColumn &column : columns.drop_front(2)) {
+        switch (column.kind) {
+          case ReportColumn::Counter:
+            OS << "  '" << column.name << "': " << column.counter(analysis);
+            break;
+          case ReportColumn::Flag:
+            OS << "  '" << column.name << "': " << (column.counter(analysis) ? "true" : "false");
+            break;
+          case ReportColumn::String:
+            /* Empty strings, e.g. a numeric-only dynamic estimate, are left out */
+            if (column.string(analysis).empty())
+              continue;
+            OS << "  '" << column.name << "': " << column.string(analysis);
+            break;
         }
+        if (column.marker)
+          OS << column.marker(analysis);
+        OS << "\n";
       }
+      OS << "-------------------------------------------\n\n";
+    }
 
-      /* If there's no debug information, or the file is not within the project root,
-        assume it's not a user-defined function */
-      return false;
+    /**
+     * @brief Write a cell in CSV format.
+     *
+     * Cells containing a comma or a quote are wrapped in quotes with every quote doubled. The
+     * cell is escaped straight into the output buffer.
+     *
+     * @param csvFile The CSV file stream.
+     * @param cell The cell content.
+     */
+    static void writeCSVCell(raw_ostream &csvFile, StringRef cell) {
+      if (cell.find_first_of(",\"") == StringRef::npos) {
+        csvFile << cell;
+        return;
+      }
+      csvFile << '"';
+      for (char c : cell) {
+        if (c == '"')
+          csvFile << '"';
+        csvFile << c;
+      }
+      csvFile << '"';
     }
 
     /**
-     * @brief Print the analysis results to standard error.
-     * @param F The LLVM function being analyzed.
-     * @param analysis The analysis results for the function.
+     * @brief Write the header row of the CSV file.
+     * @param csvFile The CSV file stream.
+     * @param columns The report columns.
      */
-    void printFunctionAnalysis(const Function &F, const FunctionAnalysis &analysis) {
-      errs() << "-------------------------------------------\n";
-      errs() << " Function Name (Demangled): " << analysis.demangledName << "\n";
-      errs() << " Function Name (Mangled): " << analysis.mangledName << "\n;";
-      errs() << "-------------------------------------------\n";
-      errs() << "  'Loads': " << analysis.loads << "\n";
-      errs() << "  'Stores': " << analysis.stores << "\n";
-      errs() << "  'Bytes': " << analysis.bytes << "\n";
-      errs() << "-------------------------------------------\n"; 
-      errs() << "\n";
+    void writeCSVHeader(raw_ostream &csvFile, ArrayRef<ReportColumn> columns) {
+      ListSeparator separator(",");
+      for (const ReportColumn &column : columns)
+        csvFile << separator << '\'' << column.name << '\'';
+      csvFile << " \n";
     }
 
     /**
-     * @brief Escape a cell for CSV formatting.
-     * @param cell The cell content to escape.
-     * @return The escaped cell.
+     * @brief Write the analysis results of a function as a CSV row.
+     * @param analysis The analysis results for the function.
+     * @param csvFile The CSV file stream.
+     * @param columns The report columns.
      */
-    std::string escapeCSV(const std::string &cell) {
-      std::string escaped = cell;
-      if (escaped.find(',') != std::string::npos || escaped.find('\"') != std::string::npos) {
-        /* Replace all " with "" */
-        size_t pos = 0;
-        while ((pos = escaped.find('\"', pos)) != std::string::npos) {
-          escaped.replace(pos, 1, "\"\"");
-          pos += 2;
+    void writeToCSV(const FunctionAnalysis &analysis, raw_ostream &csvFile, ArrayRef<ReportColumn> columns) {
+      ListSeparator separator(",");
+      for (const ReportColumn &column : columns) {
+        csvFile << separator;
+        switch (column.kind) {
+          case ReportColumn::Counter:
+            csvFile << column.counter(analysis);
+            break;
+          case ReportColumn::Flag:
+            csvFile << (column.counter(analysis) ? "true" : "false");
+            break;
+          case ReportColumn::String:
+            writeCSVCell(csvFile, column.string(analysis));
+            break;
         }
-        /* Wrap the cell in " */
-        escaped = "\"" + escaped + "\"";
       }
-      return escaped;
+      csvFile << '\n';
     }
 
     /**
-     * @brief Write the analysis results to a CSV file.
-     * @param F The LLVM function being analyzed.
+     * @brief Write the analysis results of a function as a JSON object.
+     *
+     * Counters go through rawValue so that values above INT64_MAX (saturated estimates) are
+     * written exactly instead of being converted to a signed json::Value.
+     *
      * @param analysis The analysis results for the function.
-     * @param csvFileName The name of the CSV file.
+     * @param jsonStream The JSON stream, inside the top-level array.
+     * @param columns The report columns.
+     */
+    void writeToJSON(const FunctionAnalysis &analysis, json::OStream &jsonStream, ArrayRef<ReportColumn> columns) {
+      jsonStream.object([&] {
+        for (const ReportColumn &column : columns) {
+          switch (column.kind) {
+            case ReportColumn::Counter:
+              jsonStream.attributeBegin(column.name);
+              jsonStream.rawValue([&](raw_ostream &OS) { OS << column.counter(analysis); });
+              jsonStream.attributeEnd();
+              break;
+            case ReportColumn::Flag:
+              jsonStream.attribute(column.name, column.counter(analysis) != 0);
+              break;
+            case ReportColumn::String:
+              /* Like the console, without the empty strings */
+              if (!column.string(analysis).empty())
+                jsonStream.attribute(column.name, column.string(analysis));
+              break;
+          }
+        }
+      });
+    }
+
+    /**
+     * @brief Get the name of a remark, prefixed in a pre-optimization run like the report files are suffixed (see addStageSuffix).
+     */
+    std::string getRemarkName(StringRef name) const {
+      return stage == Stage::PreOptimization ? ("PreOptimization" + name).str() : name.str();
+    }
+
+    /**
+     * @brief Emit the results of a reported function as analysis remarks.
+     *
+     * The remark streamer of the context serializes them (YAML or bitstream with
+     * -fsave-optimization-record), so every argument is keyed by its report column name. The
+     * function remark reuses the analysis of the reports; the loop footprints and line accesses
+     * are only computed when remarks of this pass are enabled (ORE.allowExtraAnalysis). With
+     * -memcheck-pipeline=both the remarks of the pre-optimization run are named apart (see
+     * getRemarkName), as the functions and locations are the same in both runs.
+     *
+     * @param F The LLVM function being reported.
+     * @param analysis Its analysis results.
+     * @param columns The report columns.
+     * @param FAM The FunctionAnalysisManager.
      */
-    void writeToCSV(const Function &F, const FunctionAnalysis &analysis, const std::string &csvFileName) {
-      static std::ofstream csvFile;
-      static bool isFileInitialized = false;
-      if (!isFileInitialized) {
-        /* Open the CSV file and write headers */
-        csvFile.open(csvFileName);
-        csvFile << "'Function Name (Demangled)','Function Name (Mangled)','Loads','Stores','Bytes' \n";
-        isFileInitialized = true;
+    void emitRemarks(Function &F, const FunctionAnalysis &analysis, ArrayRef<ReportColumn> columns,
+                     FunctionAnalysisManager &FAM) {
+      OptimizationRemarkEmitter &ORE = FAM.getResult<OptimizationRemarkEmitterAnalysis>(F);
+      if (!ORE.allowExtraAnalysis(DEBUG_TYPE))
+        return;
+
+      /* The remarks only keep a reference to their names */
+      std::string functionRemark = getRemarkName("FunctionTraffic");
+      std::string loopRemark = getRemarkName("LoopFootprint");
+      std::string lineRemark = getRemarkName("LineTraffic");
+      ORE.emit([&]() {
+        OptimizationRemarkAnalysis remark(DEBUG_TYPE, functionRemark, F.getSubprogram(), &F.getEntryBlock());
+        /* Skip the names, the remark already belongs to the function */
+        for (const ReportColumn &column : columns.drop_front(2)) {
+          if (&column != &columns[2])
+            remark << ", ";
+          remark << column.name << ": ";
+          switch (column.kind) {
+            case ReportColumn::Counter:
+              remark << ore::NV(column.name, column.counter(analysis));
+              break;
+            case ReportColumn::Flag:
+              remark << ore::NV(column.name, column.counter(analysis) ? StringRef("true") : StringRef("false"));
+              break;
+            case ReportColumn::String:
+              remark << ore::NV(column.name, column.string(analysis));
+              break;
+          }
+        }
+        return remark;
+      });
+
+      if (FootprintReport) {
+        LoopInfo &LI = FAM.getResult<LoopAnalysis>(F);
+        ScalarEvolution &SE = FAM.getResult<ScalarEvolutionAnalysis>(F);
+        for (const Loop *L : LI.getLoopsInPreorder()) {
+          LoopFootprint footprint = computeLoopFootprint(L, F.getParent()->getDataLayout(), LI, SE);
+          ORE.emit([&]() {
+            OptimizationRemarkAnalysis remark(DEBUG_TYPE, loopRemark, L->getStartLoc(), L->getHeader());
+            remark << "Loop Depth: " << ore::NV("Loop Depth", footprint.depth)
+                   << ", Trip Count: " << ore::NV("Trip Count", footprint.tripCount)
+                   << ", Footprint Bytes: " << ore::NV("Footprint Bytes", footprint.bytes)
+                   << ", Footprint Cache Lines: " << ore::NV("Footprint Cache Lines", footprint.lines)
+                   << ", Exceeds Cache: " << ore::NV("Exceeds Cache", getExceededCacheLevel(footprint.bytes));
+            if (IntensityAnalysis) {
+              double bandwidth = 0;
+              StringRef level = machineModel ? getBandwidthLevel(footprint.bytes, bandwidth) : "";
+              RooflinePoint point = getRooflinePoint(footprint.flops, footprint.trafficBytes, bandwidth);
+              remark << ", Flops: " << ore::NV("Flops", footprint.flops)
+                     << ", Arithmetic Intensity: " << ore::NV("Arithmetic Intensity", point.intensity);
+              if (machineModel)
+                remark << ", Bandwidth Level: " << ore::NV("Bandwidth Level", level)
+                       << ", Memory Bound: " << ore::NV("Memory Bound", point.isMemoryBound)
+                       << ", Attainable GFLOP/s: " << ore::NV("Attainable GFLOP/s", point.attainableGFlops);
+            }
+            return remark;
+          });
+        }
+      }
+
+      if (LineReport) {
+        LineMap lines;
+        std::map<std::string, uint64_t> stacks;
+        collectLineAccesses(F, FAM, lines, stacks);
+        for (const auto &line : lines) {
+          const LineAccesses &accesses = line.second;
+          ORE.emit([&]() {
+            return OptimizationRemarkAnalysis(DEBUG_TYPE, lineRemark, accesses.first->getDebugLoc(),
+                                              accesses.first->getParent())
+                   << "Loads: " << ore::NV("Loads", accesses.counts.loads)
+                   << ", Stores: " << ore::NV("Stores", accesses.counts.stores)
+                   << ", Bytes: " << ore::NV("Bytes", accesses.counts.bytes)
+                   << ", Weighted Loads: " << ore::NV("Weighted Loads", accesses.weightedLoads)
+                   << ", Weighted Stores: " << ore::NV("Weighted Stores", accesses.weightedStores)
+                   << ", Weighted Bytes: " << ore::NV("Weighted Bytes", accesses.weightedBytes);
+          });
+        }
       }
-      /* Write the function analysis data to the CSV file */
-      csvFile << escapeCSV(analysis.demangledName) << ','
-              << escapeCSV(analysis.mangledName) << ','
-              << analysis.loads << ','
-              << analysis.stores << ','
-              << analysis.bytes << '\n';
     }
 
     /**
-     * @brief Write the analysis results to a JSON file.
-     * @param analysis The analysis results for the function.
-     * @param functionName The name of the function.
-     * @param jsonFile The JSON file stream.
-     * @param isFirstFunction Indicates if this is the first function being written.
+     * @brief Write the analysis results of a module in the binary columnar format.
+     *
+     * See memCheckReport.h for the layout. Strings are interned, so a name shared by the mangled
+     * and demangled columns (C functions) is stored once.
+     *
+     * @param analyses The analysis results of the reported functions, in module order.
+     * @param binaryFile The binary file stream.
+     * @param columns The report columns.
      */
-    void writeToJSON(const FunctionAnalysis &analysis, const std::string &functionName, std::ofstream &jsonFile, bool isFirstFunction) {
-      if (!isFirstFunction) {
-        jsonFile << ",\n";  /* Append a comma and newline for subsequent JSON objects */
+    void writeToBinary(ArrayRef<const FunctionAnalysis *> analyses, raw_ostream &binaryFile,
+                       ArrayRef<ReportColumn> columns) {
+      using namespace memcheckReport;
+
+      /* Intern the column names and every string cell */
+      StringMap<uint32_t> stringOffsets;
+      std::string stringTable;
+      auto intern = [&](StringRef str) {
+        auto inserted = stringOffsets.try_emplace(str, uint32_t(stringTable.size()));
+        if (inserted.second) {
+          stringTable += str;
+          stringTable += '\0';
+        }
+        return inserted.first->second;
+      };
+      std::vector<uint32_t> nameOffsets;
+      std::vector<std::vector<uint32_t>> stringCells(columns.size());
+      for (size_t i = 0; i < columns.size(); ++i) {
+        nameOffsets.push_back(intern(columns[i].name));
+        if (columns[i].kind == ReportColumn::String) {
+          for (const FunctionAnalysis *analysis : analyses)
+            stringCells[i].push_back(intern(columns[i].string(*analysis)));
+        }
+      }
+
+      /* Lay out the page-aligned column data, then the string table */
+      uint64_t offset = alignTo(sizeof(BinaryHeader) + columns.size() * sizeof(BinaryColumn), binaryPageSize);
+      std::vector<BinaryColumn> directory(columns.size());
+      for (size_t i = 0; i < columns.size(); ++i) {
+        BinaryColumn &entry = directory[i];
+        entry.nameOffset = nameOffsets[i];
+        entry.type = uint32_t(columns[i].kind == ReportColumn::String ? ColumnType::String
+                              : columns[i].kind == ReportColumn::Flag ? ColumnType::Flag
+                                                                        : ColumnType::Counter);
+        entry.dataOffset = offset;
+        offset = alignTo(offset + analyses.size() * getColumnWidth(ColumnType(uint32_t(entry.type))), binaryPageSize);
+      }
+
+      BinaryHeader header;
+      std::memcpy(header.magic, binaryMagic, sizeof(header.magic));
+      header.version = binaryVersion;
+      header.columnCount = columns.size();
+      header.rowCount = analyses.size();
+      header.stringTableOffset = offset;
+      header.stringTableSize = stringTable.size();
+
+      uint64_t written = 0;
+      auto writeBytes = [&](const void *data, size_t size) {
+        binaryFile.write(static_cast<const char *>(data), size);
+        written += size;
+      };
+      auto padTo = [&](uint64_t target) {
+        binaryFile.write_zeros(target - written);
+        written = target;
+      };
+
+      writeBytes(&header, sizeof(header));
+      writeBytes(directory.data(), directory.size() * sizeof(BinaryColumn));
+      for (size_t i = 0; i < columns.size(); ++i) {
+        padTo(directory[i].dataOffset);
+        if (columns[i].kind == ReportColumn::String) {
+          for (uint32_t cell : stringCells[i]) {
+            support::ulittle32_t value(cell);
+            writeBytes(&value, sizeof(value));
+          }
+        } else {
+          for (const FunctionAnalysis *analysis : analyses) {
+            support::ulittle64_t value(columns[i].counter(*analysis));
+            writeBytes(&value, sizeof(value));
+          }
+        }
       }
+      padTo(header.stringTableOffset);
+      writeBytes(stringTable.data(), stringTable.size());
+    }
+
+    /**
+     * @brief Filter and count the defined functions of a module, in parallel with -memcheck-threads.
+     *
+     * The functions are split into contiguous chunks that workers of a ThreadPool count into
+     * their own slots of the result vectors, so the results are in module order regardless of
+     * the number of threads. Non user-defined functions are only counted when inclusive metrics
+     * or the summary need them, and functions found in the persistent cache are not counted at all.
+     *
+     * @param M The LLVM module being analyzed.
+     * @param functions The defined functions of the module, in module order.
+     * @param isUserDefined Set for each function that passes isUserDefinedFunction.
+     * @param counted The static counts of each function.
+     */
+    void countFunctions(Module &M, ArrayRef<Function *> functions, std::vector<char> &isUserDefined,
+                        std::vector<CountedFunction> &counted) {
+      std::string cacheContext = cacheFileName.empty() ? std::string() : getCacheContext(M);
+      /* Serially, the filter caches its decisions */
+      for (size_t i = 0; i < functions.size(); ++i)
+        isUserDefined[i] = isUserDefinedFunction(*functions[i]);
+
+      auto countRange = [&](size_t begin, size_t end) {
+        /* Private copy of the DataLayout, its struct layout cache is not thread-safe */
+        DataLayout DL(M.getDataLayout());
+        for (size_t i = begin; i < end; ++i) {
+          if (!isUserDefined[i] && !needsAllFunctions())
+            continue;
+
+          /* Reuse the cached analysis of unchanged functions */
+          if (!cacheFileName.empty()) {
+            counted[i].cacheKey = getCacheKey(*functions[i], cacheContext + getRegionCacheContext(*functions[i]));
+            auto it = cache.find(counted[i].cacheKey);
+            if (it != cache.end()) {
+              counted[i].analysis = it->second;
+              counted[i].analysis.mangledName = functions[i]->getName().str();
+              counted[i].isCached = true;
+              continue;
+            }
+          }
+          countFunction(*functions[i], DL, counted[i]);
+        }
+      };
 
-      /* Construct the JSON string */
-      std::stringstream jsonStream;
-      jsonStream << "  {\n";
-      jsonStream << "    \"Function Name (Demangled)\": \"" << analysis.demangledName << "\",\n";
-      jsonStream << "    \"Function Name (Mangled)\": \"" << analysis.mangledName << "\",\n";
-      jsonStream << "    \"Loads\": " << analysis.loads << ",\n";
-      jsonStream << "    \"Stores\": " << analysis.stores << ",\n";
-      jsonStream << "    \"Bytes\": " << analysis.bytes << "\n";
-      jsonStream << "  }";
+      if (Threads <= 1 || functions.size() < 2) {
+        countRange(0, functions.size());
+        return;
+      }
 
-      /* Write the JSON string to the file */
-      jsonFile << jsonStream.str();
+      /* A few chunks per thread balance functions of very different sizes */
+      size_t chunkCount = std::min<size_t>(functions.size(), Threads * 4);
+      size_t chunkSize = (functions.size() + chunkCount - 1) / chunkCount;
+      ThreadPool pool(hardware_concurrency(Threads));
+      for (size_t begin = 0; begin < functions.size(); begin += chunkSize)
+        pool.async(countRange, begin, std::min(begin + chunkSize, functions.size()));
+      pool.wait();
     }
 
   public:
+    memcheck() = default;
+
+    /**
+     * @brief Create a run at one end of the default pipeline.
+     * @param stage The end of the pipeline.
+     * @param snapshot The snapshot shared with the run at the other end, if the diff is wanted.
+     */
+    memcheck(Stage stage, std::shared_ptr<OptimizationSnapshot> snapshot)
+        : stage(stage), snapshot(std::move(snapshot)) {}
+
+    /**
+     * @brief Create the snapshot shared by a pre- and a post-optimization run.
+     */
+    static std::shared_ptr<OptimizationSnapshot> createSnapshot() {
+      return std::make_shared<OptimizationSnapshot>();
+    }
+
     /**
      * @brief Run the analysis for each function in the module.
      * @param M The LLVM module to analyze.
@@ -227,56 +4117,509 @@ namespace {
      * @return A PreservedAnalyses object.
      */
     PreservedAnalyses run(Module &M, ModuleAnalysisManager &MAM) {
-      /* Map to store the number of times each function is called */
-      std::map<Function *, int> callCounts;
+      FunctionAnalysisManager &FAM = MAM.getResult<FunctionAnalysisManagerModuleProxy>(M).getManager();
 
-      /* Iterate over all functions in the module */
+      /* Profile weighting needs a profile summary, i.e. a module built with -fprofile-use */
+      PSI = nullptr;
+      if (ProfileWeighting) {
+        ProfileSummaryInfo &profileSummary = MAM.getResult<ProfileSummaryAnalysis>(M);
+        if (profileSummary.hasProfileSummary())
+          PSI = &profileSummary;
+        else
+          errs() << "Warning: -memcheck-profile ignored, module " << M.getModuleIdentifier()
+                 << " has no profile summary.\n";
+      }
+
+      StringRef triple = M.getTargetTriple();
+      if (GPUAnalysis && !triple.startswith("nvptx") && !triple.startswith("amdgcn"))
+        errs() << "Warning: -memcheck-gpu on module " << M.getModuleIdentifier() << " of target '" << triple
+               << "', which is neither NVPTX nor AMDGPU; its address spaces may mean something else.\n";
+
+      machineModel = std::nullopt;
+      if (!MachineModelFile.empty()) {
+        if (IntensityAnalysis)
+          machineModel = loadMachineModel(MachineModelFile);
+        else
+          errs() << "Warning: -memcheck-machine ignored without -memcheck-intensity.\n";
+      }
+
+      /* Count every function in parallel, then finish them serially in module order */
+      userCodeFilter.clearCache();
+      avoidableAccesses.clear();
+      std::vector<Function *> functions;
       for (Function &F : M) {
-        /* Iterate over all basic blocks in the function */
-        for (BasicBlock &BB : F) {
-          /* Iterate over all instructions in the basic block */
-          for (Instruction &I : BB) {
-            /* If the instruction is a call instruction, increment the call count */
-            if (CallInst *callInst = dyn_cast<CallInst>(&I)) {
-              /* If the called function is defined in the user's source files */
-              if (Function *calledFunction = callInst->getCalledFunction()) {
-                callCounts[calledFunction]++;
-              }
-            }
+        if (!F.isDeclaration())
+          functions.push_back(&F);
+      }
+      std::vector<char> isUserDefined(functions.size());
+      std::vector<CountedFunction> counted(functions.size());
+      {
+        NamedRegionTimer timer("count", "Count functions", timerGroupName, timerGroupDescription, TimePassesIsEnabled);
+        loadCache(M);
+        if (OpenMPAnalysis)
+          findParallelRegions(M);
+        if (GPUAnalysis)
+          findAnnotatedKernels(M);
+        countFunctions(M, functions, isUserDefined, counted);
+      }
+
+      /* Results of every function analyzed so far, shared by all functions of the module */
+      std::map<Function *, FunctionAnalysis> analysisMap;
+      {
+        NamedRegionTimer timer("finish", "Finish functions", timerGroupName, timerGroupDescription, TimePassesIsEnabled);
+        for (size_t i = 0; i < functions.size(); ++i) {
+          if (!isUserDefined[i] && !needsAllFunctions())
+            continue;
+          if (counted[i].isCached) {
+            analysisMap[functions[i]] = counted[i].analysis;
+            ++NumFunctionsCached;
+          } else {
+            analysisMap[functions[i]] = finishFunction(*functions[i], counted[i], FAM);
+            ++NumFunctionsCounted;
+            NumAccessesCounted += counted[i].analysis.loads + counted[i].analysis.stores;
           }
+          /* Only the cache key is needed from here on */
+          counted[i].blockTotals = {};
+          counted[i].deferredIntrinsics = {};
+          counted[i].accesses = {};
+        }
+        saveCache(functions, counted, analysisMap);
+        cache.clear();
+
+        /* Attribute the outlined parallel regions to the functions forking them */
+        if (OpenMPAnalysis)
+          attributeParallelRegions(analysisMap);
+
+        /* Kernels depend on module metadata, they are flagged afresh even for cached functions */
+        if (GPUAnalysis) {
+          for (auto &entry : analysisMap)
+            entry.second.isGPUKernel = isGPUKernel(*entry.first);
         }
       }
 
-      /* Open the json file at the beginning */
-      std::ofstream jsonFile(jsonFileName);
-      jsonFile << "[\n"; // Write opening bracket
-      bool isFirstFunction = true;
-      for (Function &F : M) {
+      /* Roll the metrics up the call graph, weighting each callee by its call sites */
+      if (InclusiveMetrics) {
+        NamedRegionTimer timer("inclusive", "Inclusive metrics", timerGroupName, timerGroupDescription, TimePassesIsEnabled);
+        computeInclusiveMetrics(MAM.getResult<CallGraphAnalysis>(M), analysisMap, FAM);
+      }
+
+      /* Place the functions on the roofline of the machine model */
+      if (IntensityAnalysis) {
+        for (auto &entry : analysisMap)
+          placeOnRoofline(entry.second);
+      }
+
+      /* The summary describes the optimized code, a pre-optimization run leaves it to the post-optimization one */
+      if (SummaryMetadata && stage != Stage::PreOptimization)
+        writeSummaryMetadata(M, functions, isUserDefined, analysisMap, FAM);
+
+      /* Everything from here on writes the reports */
+      NamedRegionTimer reportTimer("report", "Write reports", timerGroupName, timerGroupDescription, TimePassesIsEnabled);
+
+      /* Remarks replace the report files, the remark streamer names and writes them */
+      std::vector<const FunctionAnalysis *> reported;
+      if (RemarksOutput) {
+        std::vector<ReportColumn> columns = getReportColumns();
+        for (size_t i = 0; i < functions.size(); ++i) {
+          if (isUserDefined[i]) {
+            analyzeFunction(*functions[i], analysisMap, FAM);
+            emitRemarks(*functions[i], analysisMap[functions[i]], columns, FAM);
+            reported.push_back(&analysisMap[functions[i]]);
+            ++NumFunctionsReported;
+          }
+        }
+        summarizeModule(M, reported, columns);
+        return PreservedAnalyses::all();
+      }
+
+      /* Open the output files at the beginning */
+      if (!setOutputFileNames(M))
+        return PreservedAnalyses::all();
+      std::error_code EC;
+      raw_fd_ostream csvFile(csvFileName, EC, sys::fs::OF_Text);
+      if (EC) {
+        errs() << "Error: cannot open " << csvFileName << ": " << EC.message() << "\n";
+        return PreservedAnalyses::all();
+      }
+      raw_fd_ostream jsonFile(jsonFileName, EC, sys::fs::OF_Text);
+      if (EC) {
+        errs() << "Error: cannot open " << jsonFileName << ": " << EC.message() << "\n";
+        return PreservedAnalyses::all();
+      }
+      /* Buffered, unlike errs(), the per-function dump is large */
+      raw_fd_ostream console(2, /*shouldClose=*/false);
+
+      std::vector<ReportColumn> columns = getReportColumns();
+      writeCSVHeader(csvFile, columns);
+      json::OStream jsonStream(jsonFile, /*IndentSize=*/2);
+      jsonStream.arrayBegin();
+      for (size_t i = 0; i < functions.size(); ++i) {
+        Function &F = *functions[i];
         ////////////////////////////////////////////////////////////
-        if (isUserDefinedFunction(F) && !F.isDeclaration()) {
-        // if (isUserDefinedFunction(F) && !F.isDeclaration() && F.getName() != "main") {
+        if (isUserDefined[i]) {
+        // if (isUserDefined[i] && F.getName() != "main") {
         ////////////////////////////////////////////////////////////
-          /* Clear the visited functions set */
-          visitedFunctions.clear();
           /* Analyze the function */
-          std::map<Function *, FunctionAnalysis> analysisMap;
-          FunctionAnalysis analysis = analyzeFunction(F, analysisMap);
-          /* Print the analysis to errs() */
-          printFunctionAnalysis(F, analysis);
+          analyzeFunction(F, analysisMap, FAM);
+          const FunctionAnalysis &analysis = analysisMap[&F];
+          /* Print the analysis to standard error */
+          if (!Quiet)
+            printFunctionAnalysis(console, analysis, columns);
           /* Write the analysis to a CSV file */
-          writeToCSV(F, analysis, csvFileName);
+          writeToCSV(analysis, csvFile, columns);
           /* Write the analysis to a JSON file */
-          writeToJSON(analysis, F.getName().str(), jsonFile, isFirstFunction);
-          /* Close the top bracket of the JSON file */
-          isFirstFunction = false;
+          writeToJSON(analysis, jsonStream, columns);
+          reported.push_back(&analysis);
+          ++NumFunctionsReported;
+        }
+      }
+      jsonStream.arrayEnd();
+      jsonFile << "\n";
+      console.flush();
+
+      /* Write the loop report of the reported functions */
+      if (FootprintReport) {
+        raw_fd_ostream loopsFile(loopsFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << loopsFileName << ": " << EC.message() << "\n";
+        } else {
+          loopsFile << "'Function Name (Demangled)','Function Name (Mangled)','Loop Location','Loop Depth'"
+                    << ",'Trip Count','Footprint Bytes','Footprint Cache Lines','Exceeds Cache'";
+          if (IntensityAnalysis)
+            loopsFile << ",'Flops','Traffic Bytes','Arithmetic Intensity'";
+          if (IntensityAnalysis && machineModel)
+            loopsFile << ",'Bandwidth Level','Memory Bound','Attainable GFLOP/s','Memory Excess Time (ps)'";
+          loopsFile << " \n";
+          for (size_t i = 0; i < functions.size(); ++i) {
+            if (isUserDefined[i])
+              writeLoopFootprints(*functions[i], FAM, loopsFile);
+          }
+        }
+      }
+
+      /* Write the per-line redundancy report of the reported functions */
+      if (RedundancyAnalysis) {
+        raw_fd_ostream redundancyFile(redundancyFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << redundancyFileName << ": " << EC.message() << "\n";
+        } else {
+          redundancyFile << "'Function Name (Demangled)','Function Name (Mangled)','Source Line','Redundant Loads'"
+                         << ",'Redundant Load Bytes','Dead Stores','Dead Store Bytes' \n";
+          for (size_t i = 0; i < functions.size(); ++i) {
+            if (isUserDefined[i])
+              writeAvoidableAccesses(*functions[i], FAM, redundancyFile);
+          }
+        }
+      }
+
+      /* Write the allocation report of the reported functions */
+      if (AllocationReport) {
+        raw_fd_ostream allocationsFile(allocationsFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << allocationsFileName << ": " << EC.message() << "\n";
+        } else {
+          allocationsFile << "'Function Name (Demangled)','Function Name (Mangled)','Call Site','Allocator'"
+                          << ",'Loop Depth','Executions' \n";
+          for (size_t i = 0; i < functions.size(); ++i) {
+            if (isUserDefined[i])
+              writeAllocationSites(*functions[i], FAM, allocationsFile);
+          }
+        }
+      }
+
+      /* Write the false-sharing hints of the reported parallel regions */
+      if (OpenMPAnalysis) {
+        raw_fd_ostream falseSharingFile(falseSharingFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << falseSharingFileName << ": " << EC.message() << "\n";
+        } else {
+          falseSharingFile << "'Function Name (Demangled)','Function Name (Mangled)','Parallel Parent','Store Location'"
+                           << ",'Pattern','Distance Bytes' \n";
+          for (size_t i = 0; i < functions.size(); ++i) {
+            if (isUserDefined[i])
+              writeFalseSharingHints(*functions[i], analysisMap[functions[i]], falseSharingFile);
+          }
+        }
+      }
+
+      /* Write the struct field report of the reported functions */
+      if (FieldReport) {
+        raw_fd_ostream fieldsFile(fieldsFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << fieldsFileName << ": " << EC.message() << "\n";
+        } else {
+          MapVector<StructType *, SmallVector<FieldAccesses, 8>> fields;
+          for (size_t i = 0; i < functions.size(); ++i) {
+            if (isUserDefined[i])
+              collectFieldAccesses(*functions[i], FAM, fields);
+          }
+          fieldsFile << "'Struct Type','Struct Bytes','Field','Offset','Size','Padding After','Loads','Stores'"
+                     << ",'Weighted Accesses','Cache Lines','Hot','Hot Set Cache Lines' \n";
+          writeFieldReport(fields, M.getDataLayout(), fieldsFile);
         }
       }
-      jsonFile << "\n]"; /* Write closing bracket at the end */
-      jsonFile.close();
 
+      /* Write the per-line report and the flame graph stacks of the reported functions */
+      if (LineReport) {
+        LineMap lines;
+        std::map<std::string, uint64_t> stacks;
+        for (size_t i = 0; i < functions.size(); ++i) {
+          if (isUserDefined[i])
+            collectLineAccesses(*functions[i], FAM, lines, stacks);
+        }
+        raw_fd_ostream linesFile(linesFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << linesFileName << ": " << EC.message() << "\n";
+        } else {
+          linesFile << "'Source File','Line','Column','Loads','Stores','Bytes','Weighted Loads','Weighted Stores'"
+                    << ",'Weighted Bytes' \n";
+          for (const auto &line : lines) {
+            writeCSVCell(linesFile, std::get<0>(line.first));
+            linesFile << ',' << std::get<1>(line.first) << ',' << std::get<2>(line.first) << ',' << line.second.counts.loads
+                      << ',' << line.second.counts.stores << ',' << line.second.counts.bytes
+                      << ',' << line.second.weightedLoads << ',' << line.second.weightedStores
+                      << ',' << line.second.weightedBytes << '\n';
+          }
+        }
+        /* One "frame;frame;... bytes" line per stack, read by flamegraph.pl, inferno or speedscope */
+        raw_fd_ostream foldedFile(foldedFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << foldedFileName << ": " << EC.message() << "\n";
+        } else {
+          for (const auto &stack : stacks) {
+            if (stack.second)
+              foldedFile << stack.first << ' ' << stack.second << '\n';
+          }
+        }
+      }
+
+      /* Keep the reported functions for the diff of the post-optimization run */
+      if (stage == Stage::PreOptimization && snapshot) {
+        snapshot->moduleIdentifier = M.getModuleIdentifier();
+        snapshot->functions.clear();
+        for (const FunctionAnalysis *analysis : reported)
+          snapshot->functions.push_back(*analysis);
+      }
+
+      /* Write what the optimizer did to the traffic of the module */
+      if (stage == Stage::PostOptimization && snapshot && snapshot->moduleIdentifier == M.getModuleIdentifier()) {
+        raw_fd_ostream diffFile(diffFileName, EC, sys::fs::OF_Text);
+        if (EC) {
+          errs() << "Error: cannot open " << diffFileName << ": " << EC.message() << "\n";
+        } else {
+          uint64_t bytesBefore = 0, bytesAfter = 0;
+          writeOptimizationDiff(*snapshot, reported, diffFile, bytesBefore, bytesAfter);
+          if (!Quiet)
+            errs() << "Optimization of " << M.getModuleIdentifier() << ": " << bytesBefore << " -> " << bytesAfter
+                   << " bytes (see " << diffFileName << ")\n";
+        }
+        snapshot->moduleIdentifier.clear();
+        snapshot->functions.clear();
+      }
+
+      /* Write the binary report once all rows are known */
+      if (BinaryReport) {
+        raw_fd_ostream binaryFile(binaryFileName, EC);
+        if (EC)
+          errs() << "Error: cannot open " << binaryFileName << ": " << EC.message() << "\n";
+        else
+          writeToBinary(reported, binaryFile, columns);
+      }
+
+      /* A regression error may end the process, the reports have to be complete by then */
+      csvFile.close();
+      jsonFile.close();
+      summarizeModule(M, reported, columns);
       return PreservedAnalyses::all();
     }
   };
+
+  /**
+   * @brief Pass inserting per-block memory access counters, for the runtime library in memCheckRuntime.cpp.
+   *
+   * Every basic block of a user-defined function adds its static counts (as counted by the
+   * memcheck pass) to the counters of the current thread once per execution, so the overhead is
+   * a few increments per block instead of one per access. Memory intrinsics of non-constant length
+   * add their actual length, and the entry block counts the calls of the function, which relate
+   * the per-invocation static estimates to the measured totals. The runtime writes the counters at
+   * exit in the static report format.
+   */
+  class memcheckInstrument : public PassInfoMixin<memcheckInstrument> {
+  private:
+    /* Static counts of one basic block */
+    using BlockCounters = std::array<uint64_t, memcheckCounterCount>;
+
+    /* Counting rules and user-code filter of the static pass */
+    memcheck analysis;
+
+    /**
+     * @brief Create a private constant C string.
+     */
+    static Constant *createString(Module &M, StringRef str) {
+      Constant *init = ConstantDataArray::getString(M.getContext(), str);
+      auto *string = new GlobalVariable(M, init->getType(), /*isConstant=*/true, GlobalValue::PrivateLinkage,
+                                        init, "__memcheck_name");
+      string->setUnnamedAddr(GlobalValue::UnnamedAddr::Global);
+      return ConstantExpr::getPointerCast(string, PointerType::getUnqual(Type::getInt8Ty(M.getContext())));
+    }
+
+    /**
+     * @brief Create the memcheckModule descriptor of a module (see memCheckRuntime.h).
+     */
+    static GlobalVariable *createModuleDescriptor(Module &M, ArrayRef<Function *> functions) {
+      LLVMContext &C = M.getContext();
+      Type *int32Ty = Type::getInt32Ty(C);
+      PointerType *stringTy = PointerType::getUnqual(Type::getInt8Ty(C));
+
+      SmallVector<Constant *, 16> names;
+      for (Function *F : functions) {
+        names.push_back(createString(M, F->getName()));
+        names.push_back(createString(M, demangle(F->getName().str())));
+      }
+      ArrayType *namesTy = ArrayType::get(stringTy, names.size());
+      auto *namesArray = new GlobalVariable(M, namesTy, /*isConstant=*/true, GlobalValue::PrivateLinkage,
+                                            ConstantArray::get(namesTy, names), "__memcheck_names");
+
+      StructType *moduleTy = StructType::get(C, {int32Ty, int32Ty, PointerType::getUnqual(stringTy), stringTy});
+      Constant *init = ConstantStruct::get(moduleTy, {
+        ConstantInt::get(int32Ty, MEMCHECK_RUNTIME_VERSION),
+        ConstantInt::get(int32Ty, functions.size()),
+        ConstantExpr::getPointerCast(namesArray, PointerType::getUnqual(stringTy)),
+        createString(M, M.getModuleIdentifier()),
+      });
+      return new GlobalVariable(M, moduleTy, /*isConstant=*/true, GlobalValue::PrivateLinkage, init,
+                                "__memcheck_module");
+    }
+
+    /**
+     * @brief Add a constant or a value to a counter of the current function.
+     */
+    static void addToCounter(IRBuilder<> &builder, Value *counters, unsigned counter, Value *value) {
+      Type *int64Ty = builder.getInt64Ty();
+      Value *address = builder.CreateConstInBoundsGEP1_64(int64Ty, counters, counter);
+      Value *count = builder.CreateLoad(int64Ty, address);
+      builder.CreateStore(builder.CreateAdd(count, value), address);
+    }
+
+    /**
+     * @brief Instrument one function.
+     * @param F The LLVM function.
+     * @param index The index of the function in the module descriptor.
+     * @param descriptor The module descriptor.
+     * @param counterSlot The thread_local cache of the counters of the current thread.
+     * @param getCounters The runtime function returning the counters of the current thread.
+     */
+    void instrumentFunction(Function &F, unsigned index, GlobalVariable *descriptor, GlobalVariable *counterSlot,
+                            FunctionCallee getCounters) {
+      const DataLayout &DL = F.getParent()->getDataLayout();
+
+      /* Count every block before the entry block is split */
+      SmallVector<std::pair<BasicBlock *, BlockCounters>, 16> blocks;
+      SmallVector<AnyMemIntrinsic *, 4> deferredIntrinsics;
+      for (BasicBlock &BB : F) {
+        memcheck::FunctionAnalysis categories;
+        memcheck::AccessTotals totals;
+        for (Instruction &I : BB) {
+          bool isDeferred = false;
+          totals.add(analysis.countInstruction(I, DL, categories, isDeferred));
+          if (isDeferred)
+            deferredIntrinsics.push_back(cast<AnyMemIntrinsic>(&I));
+        }
+        BlockCounters counters = {};
+        counters[memcheckLoads] = totals.loads;
+        counters[memcheckStores] = totals.stores;
+        counters[memcheckBytes] = totals.bytes;
+        counters[memcheckMemIntrinsics] = categories.memIntrinsics;
+        counters[memcheckMemIntrinsicBytes] = categories.memIntrinsicBytes;
+        counters[memcheckAtomics] = categories.atomics;
+        counters[memcheckAtomicBytes] = categories.atomicBytes;
+        counters[memcheckMaskedLoads] = categories.maskedLoads;
+        counters[memcheckMaskedStores] = categories.maskedStores;
+        counters[memcheckMaskedBytes] = categories.maskedBytes;
+        counters[memcheckCalls] = &BB == &F.getEntryBlock();
+        if (std::any_of(counters.begin(), counters.end(), [](uint64_t count) { return count; }))
+          blocks.push_back({&BB, counters});
+      }
+      /* Fetch the counters of the thread after the static allocas, calling the runtime only the first time */
+      BasicBlock &entry = F.getEntryBlock();
+      BasicBlock::iterator splitPoint = entry.getFirstInsertionPt();
+      while (isa<AllocaInst>(*splitPoint))
+        ++splitPoint;
+      IRBuilder<> builder(&entry, splitPoint);
+      PointerType *countersTy = PointerType::getUnqual(builder.getInt64Ty());
+      Value *cached = builder.CreateLoad(countersTy, counterSlot);
+      Instruction *slowPath = SplitBlockAndInsertIfThen(builder.CreateIsNull(cached), &*splitPoint,
+                                                        /*Unreachable=*/false,
+                                                        MDBuilder(F.getContext()).createBranchWeights(1, 1 << 20));
+      builder.SetInsertPoint(slowPath);
+      Value *fresh = builder.CreateCall(getCounters, {ConstantExpr::getPointerCast(descriptor, PointerType::getUnqual(builder.getInt8Ty()))});
+      builder.CreateStore(fresh, counterSlot);
+
+      BasicBlock *tail = splitPoint->getParent();
+      builder.SetInsertPoint(tail, tail->begin());
+      PHINode *threadCounters = builder.CreatePHI(countersTy, 2);
+      threadCounters->addIncoming(cached, &entry);
+      threadCounters->addIncoming(fresh, slowPath->getParent());
+      Value *counters = builder.CreateConstInBoundsGEP1_64(builder.getInt64Ty(), threadCounters,
+                                                           uint64_t(index) * memcheckCounterCount);
+      Instruction *entryInsertPoint = &*builder.GetInsertPoint();
+
+      for (const auto &block : blocks) {
+        /* The accesses of the entry block now live in the tail */
+        BasicBlock::iterator insertPoint = block.first == &entry ? entryInsertPoint->getIterator()
+                                                                 : block.first->getFirstInsertionPt();
+        if (insertPoint == block.first->end())
+          continue;
+        builder.SetInsertPoint(insertPoint->getParent(), insertPoint);
+        for (unsigned counter = 0; counter < memcheckCounterCount; ++counter) {
+          if (block.second[counter])
+            addToCounter(builder, counters, counter, builder.getInt64(block.second[counter]));
+        }
+      }
+
+      /* memcpy and memmove read and write their length, memset only writes it */
+      for (AnyMemIntrinsic *memIntrinsic : deferredIntrinsics) {
+        builder.SetInsertPoint(memIntrinsic);
+        Value *bytes = builder.CreateZExtOrTrunc(memIntrinsic->getLength(), builder.getInt64Ty());
+        if (isa<AnyMemTransferInst>(memIntrinsic))
+          bytes = builder.CreateShl(bytes, 1);
+        addToCounter(builder, counters, memcheckBytes, bytes);
+        addToCounter(builder, counters, memcheckMemIntrinsicBytes, bytes);
+      }
+    }
+
+  public:
+    /**
+     * @brief Instrument every user-defined function of the module.
+     * @param M The LLVM module to instrument.
+     * @return PreservedAnalyses::none() if anything was instrumented.
+     */
+    PreservedAnalyses run(Module &M, ModuleAnalysisManager &) {
+      std::vector<Function *> functions;
+      analysis.userCodeFilter.clearCache();
+      for (Function &F : M) {
+        if (!F.isDeclaration() && analysis.isUserDefinedFunction(F))
+          functions.push_back(&F);
+      }
+      if (functions.empty())
+        return PreservedAnalyses::all();
+
+      LLVMContext &C = M.getContext();
+      PointerType *countersTy = PointerType::getUnqual(Type::getInt64Ty(C));
+      GlobalVariable *descriptor = createModuleDescriptor(M, functions);
+      auto *counterSlot = new GlobalVariable(M, countersTy, /*isConstant=*/false, GlobalValue::InternalLinkage,
+                                             ConstantPointerNull::get(countersTy), "__memcheck_counters",
+                                             nullptr, GlobalValue::InitialExecTLSModel);
+      FunctionCallee getCounters = M.getOrInsertFunction(
+          "__memcheck_thread_counters",
+          FunctionType::get(countersTy, {PointerType::getUnqual(Type::getInt8Ty(C))}, /*isVarArg=*/false));
+
+      for (size_t i = 0; i < functions.size(); ++i)
+        instrumentFunction(*functions[i], i, descriptor, counterSlot, getCounters);
+      NumFunctionsInstrumented += functions.size();
+      return PreservedAnalyses::none();
+    }
+  };
 } /* end of anonymous namespace */
 
 
@@ -290,6 +4633,22 @@ llvmGetPassPluginInfo() {
   return {
     LLVM_PLUGIN_API_VERSION, "memcheck", LLVM_VERSION_STRING,
     [](llvm::PassBuilder &PB) {
+      /* With clang -fpass-plugin, report the ends of the default pipeline chosen by -memcheck-pipeline, and with both what changed in between */
+      auto snapshot = memcheck::createSnapshot();
+      PB.registerPipelineStartEPCallback(
+        [snapshot](llvm::ModulePassManager &MPM, llvm::OptimizationLevel) {
+          if (PipelinePositions == PipelinePosition::Start || PipelinePositions == PipelinePosition::Both)
+            MPM.addPass(memcheck(memcheck::Stage::PreOptimization,
+                                 PipelinePositions == PipelinePosition::Both ? snapshot : nullptr));
+        }
+      );
+      PB.registerOptimizerLastEPCallback(
+        [snapshot](llvm::ModulePassManager &MPM, llvm::OptimizationLevel) {
+          if (PipelinePositions == PipelinePosition::Last || PipelinePositions == PipelinePosition::Both)
+            MPM.addPass(memcheck(memcheck::Stage::PostOptimization,
+                                 PipelinePositions == PipelinePosition::Both ? snapshot : nullptr));
+        }
+      );
       PB.registerPipelineParsingCallback(
         [](llvm::StringRef Name, llvm::ModulePassManager &MPM,
             llvm::ArrayRef<llvm::PassBuilder::PipelineElement>) {
@@ -297,6 +4656,10 @@ llvmGetPassPluginInfo() {
             MPM.addPass(memcheck());
             return true;
           }
+          if (Name == "memcheck-instrument") {
+            MPM.addPass(memcheckInstrument());
+            return true;
+          }
           return false;
         }
       );